@@ -0,0 +1,277 @@
+#include "ActionDispatcher.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+#define ACTION_SHELL L"cmd.exe /c "
+
+// Invalid UTF-8 becomes U+FFFD rather than throwing
+static std::wstring utf8ToWide(const std::string& str)
+{
+    if (str.empty())
+    {
+        return std::wstring();
+    }
+    auto length = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), NULL, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &wide[0], length);
+    return wide;
+}
+
+static bool isLowMessage(DWORD msg)
+{
+    return msg < ACTION_LOW_MESSAGES;
+}
+
+static size_t capacityFor(size_t count)
+{
+    size_t capacity = ACTION_TABLE_MIN_CAPACITY;
+    while (capacity < count * 2)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+ActionTable::ActionTable(const std::vector<Entry>& entries)
+{
+    slots.resize(capacityFor(entries.size()));
+    for (auto& entry : entries)
+    {
+        auto slot = slotOf(entry.first);
+        while (slots[slot].second)
+        {
+            slot = (slot + 1) & (slots.size() - 1);
+        }
+        slots[slot] = entry;
+    }
+}
+
+Action* ActionTable::find(DWORD msg) const
+{
+    for (auto slot = slotOf(msg); slots[slot].second; slot = (slot + 1) & (slots.size() - 1))
+    {
+        if (slots[slot].first == msg)
+        {
+            return slots[slot].second.get();
+        }
+    }
+    return NULL;
+}
+
+std::vector<ActionTable::Entry> ActionTable::entries() const
+{
+    std::vector<Entry> ret;
+    for (auto& slot : slots)
+    {
+        if (slot.second)
+        {
+            ret.push_back(slot);
+        }
+    }
+    return ret;
+}
+
+size_t ActionTable::slotOf(DWORD msg) const
+{
+    // Fibonacci hashing: message IDs tend to be clustered
+    return (size_t)((msg * 2654435769u) >> 8) & (slots.size() - 1);
+}
+
+ActionDispatcher::ActionDispatcher()
+{
+    actions = std::make_shared<const ActionTable>(std::vector<ActionTable::Entry>());
+    for (auto& bits : lowMessageBits)
+    {
+        bits = 0;
+    }
+    highMessageCount = 0;
+    stopping = false;
+    worker = std::thread(&ActionDispatcher::workerLoop, this);
+}
+
+ActionDispatcher::~ActionDispatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_one();
+    worker.join();
+
+    // Children keep running on their own, we just stop tracking them
+    for (auto hProcess : children)
+    {
+        CloseHandle(hProcess);
+    }
+    children.clear();
+}
+
+void ActionDispatcher::setAction(DWORD msg, const std::string& command, ULONGLONG debounceMs)
+{
+    auto action = std::make_shared<Action>();
+    action->command = utf8ToWide(command);
+    action->debounceMs = debounceMs;
+
+    auto entries = std::atomic_load(&actions)->entries();
+    bool replaced = false;
+    for (auto& entry : entries)
+    {
+        if (entry.first == msg)
+        {
+            entry.second = action;
+            replaced = true;
+        }
+    }
+    if (!replaced)
+    {
+        entries.push_back({ msg, action });
+    }
+    publish(entries);
+
+    if (isLowMessage(msg))
+    {
+        lowMessageBits[msg / 32] |= (1u << (msg % 32));
+    }
+    else if (!replaced)
+    {
+        highMessageCount++;
+    }
+}
+
+bool ActionDispatcher::removeAction(DWORD msg)
+{
+    auto entries = std::atomic_load(&actions)->entries();
+    auto it = std::find_if(entries.begin(), entries.end(), [msg](const ActionTable::Entry& entry) { return entry.first == msg; });
+    if (it == entries.end())
+    {
+        return false;
+    }
+    entries.erase(it);
+
+    if (isLowMessage(msg))
+    {
+        lowMessageBits[msg / 32] &= ~(1u << (msg % 32));
+    }
+    else
+    {
+        highMessageCount--;
+    }
+
+    publish(entries);
+    return true;
+}
+
+std::vector<ActionTable::Entry> ActionDispatcher::getActions() const
+{
+    return std::atomic_load(&actions)->entries();
+}
+
+void ActionDispatcher::publish(const std::vector<ActionTable::Entry>& entries)
+{
+    // The UI thread may be reading the current table, so changes go into a new one that replaces it
+    std::atomic_store(&actions, std::shared_ptr<const ActionTable>(std::make_shared<ActionTable>(entries)));
+}
+
+bool ActionDispatcher::dispatch(DWORD msg)
+{
+    if (isLowMessage(msg) ? !(lowMessageBits[msg / 32].load(std::memory_order_relaxed) & (1u << (msg % 32))) : !highMessageCount)
+    {
+        return false;
+    }
+
+    // Keeps the Action alive even if it's replaced while we use it
+    auto current = std::atomic_load(&actions);
+    auto found = current->find(msg);
+    if (!found)
+    {
+        return false;
+    }
+
+    auto& action = *found;
+    auto now = GetTickCount64();
+    if (action.debounceMs && now - action.lastTriggered < action.debounceMs)
+    {
+        return false;
+    }
+    action.lastTriggered = now;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (queue.size() >= ACTION_QUEUE_SIZE)
+        {
+            log(LogLevel::Warning, "Action queue is full, dropping action for msg: " + std::to_string(msg));
+            return false;
+        }
+        queue.push_back(action.command);
+    }
+    queueCondition.notify_one();
+    return true;
+}
+
+void ActionDispatcher::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (!stopping)
+    {
+        // Wakes up now and then while children are running, to notice when they finish. With none, it sleeps until
+        // there's something to launch. (children is only touched by this thread.)
+        auto ready = [this]() { return stopping || (queue.size() > 0 && children.size() < ACTION_MAX_CHILDREN); };
+        if (children.empty())
+        {
+            queueCondition.wait(lock, ready);
+        }
+        else
+        {
+            queueCondition.wait_for(lock, std::chrono::milliseconds(ACTION_REAP_INTERVAL_MS), ready);
+        }
+
+        lock.unlock();
+        reapChildren();
+        lock.lock();
+
+        while (!stopping && queue.size() && children.size() < ACTION_MAX_CHILDREN)
+        {
+            auto command = std::move(queue.front());
+            queue.pop_front();
+
+            lock.unlock();
+            launch(command);
+            lock.lock();
+        }
+    }
+}
+
+void ActionDispatcher::launch(const std::wstring& command)
+{
+    // CreateProcessW may write to the command line, so it needs its own copy
+    std::wstring commandLine = ACTION_SHELL + command;
+
+    STARTUPINFOW startupInfo = { sizeof(startupInfo) };
+    PROCESS_INFORMATION processInfo = { 0 };
+    if (!CreateProcessW(NULL, &commandLine[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startupInfo, &processInfo))
+    {
+        log(LogLevel::Error, "Failed to launch action: " + std::to_string(GetLastError()));
+        return;
+    }
+
+    CloseHandle(processInfo.hThread);
+    children.push_back(processInfo.hProcess);
+}
+
+void ActionDispatcher::reapChildren()
+{
+    for (size_t i = 0; i < children.size();)
+    {
+        if (WaitForSingleObject(children[i], 0) == WAIT_OBJECT_0)
+        {
+            CloseHandle(children[i]);
+            children[i] = children.back();
+            children.pop_back();
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
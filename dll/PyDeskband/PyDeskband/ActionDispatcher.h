@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define ACTION_QUEUE_SIZE 64
+#define ACTION_MAX_CHILDREN 4
+#define ACTION_REAP_INTERVAL_MS 100
+
+// Messages below this are looked up in a bitset first. Nearly every message WndProc sees is down here.
+#define ACTION_LOW_MESSAGES WM_USER
+#define ACTION_TABLE_MIN_CAPACITY 8
+
+// A shell command to run when a window message arrives
+struct Action
+{
+    std::wstring command;
+    ULONGLONG debounceMs = 0;
+
+    // when it was last queued. Triggers within debounceMs of it are dropped.
+    std::atomic<ULONGLONG> lastTriggered = 0;
+};
+
+// msg -> Action as a flat, open-addressed hash table. Immutable once built.
+class ActionTable
+{
+public:
+    typedef std::pair<DWORD, std::shared_ptr<Action>> Entry;
+
+    ActionTable(const std::vector<Entry>& entries);
+
+    Action* find(DWORD msg) const;
+    // every entry, for building the next version of the table
+    std::vector<Entry> entries() const;
+
+private:
+    size_t slotOf(DWORD msg) const;
+
+    // a power of 2 in size and at most half full, so probing ends quickly. Empty slots have a NULL action.
+    std::vector<Entry> slots;
+};
+
+// Runs the commands registered for window messages on a worker thread, so the window procedure never waits on them.
+// Registration happens on the pipe thread and dispatch on the UI thread: the registry is published as an immutable
+// snapshot, so dispatching never takes a lock unless there's something to queue. dispatch runs for every message
+// WndProc doesn't handle itself, so messages without an action are turned away by a single bit test (or, above
+// ACTION_LOW_MESSAGES, a counter check) before the snapshot is even looked at.
+class ActionDispatcher
+{
+public:
+    ActionDispatcher();
+    ~ActionDispatcher();
+
+    // Pipe thread. removeAction returns false if msg had no action.
+    void setAction(DWORD msg, const std::string& command, ULONGLONG debounceMs);
+    bool removeAction(DWORD msg);
+    // Any thread. Every message with an action, and the action.
+    std::vector<ActionTable::Entry> getActions() const;
+
+    // UI thread. Queues msg's command, if it has one. Returns true if it did.
+    bool dispatch(DWORD msg);
+
+private:
+    void workerLoop();
+    void publish(const std::vector<ActionTable::Entry>& entries);
+    void launch(const std::wstring& command);
+    void reapChildren();
+
+    // only accessed through std::atomic_load / std::atomic_store
+    std::shared_ptr<const ActionTable> actions;
+
+    // A message's bit is set once its action is published and cleared before its removal is, so a clear bit
+    // always means there's nothing to do. (A set one is checked against the table.)
+    std::atomic<uint32_t> lowMessageBits[ACTION_LOW_MESSAGES / 32];
+    std::atomic<size_t> highMessageCount;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<std::wstring> queue;
+    bool stopping;
+
+    // worker thread only
+    std::vector<HANDLE> children;
+    std::thread worker;
+};
@@ -0,0 +1,80 @@
+#include "Animation.h"
+
+double applyEasing(Easing easing, double progress)
+{
+    // cubic curves
+    switch (easing)
+    {
+    case Easing::EaseIn:
+        return progress * progress * progress;
+    case Easing::EaseOut:
+    {
+        auto remaining = 1.0 - progress;
+        return 1.0 - remaining * remaining * remaining;
+    }
+    case Easing::EaseInOut:
+        if (progress < 0.5)
+        {
+            return 4.0 * progress * progress * progress;
+        }
+        else
+        {
+            auto remaining = 2.0 - 2.0 * progress;
+            return 1.0 - remaining * remaining * remaining / 2.0;
+        }
+    case Easing::Linear:
+    default:
+        return progress;
+    }
+}
+
+bool Animator::start(const Animation& animation)
+{
+    for (auto& running : animations)
+    {
+        if (running.target == animation.target && running.property == animation.property)
+        {
+            running = animation;
+            return true;
+        }
+    }
+
+    if (animations.size() >= ANIMATION_MAX_ANIMATIONS)
+    {
+        return false;
+    }
+    animations.push_back(animation);
+    return true;
+}
+
+void Animator::cancel(TextInfoHandle target)
+{
+    for (size_t i = 0; i < animations.size();)
+    {
+        if (animations[i].target == target)
+        {
+            animations[i] = animations.back();
+            animations.pop_back();
+            continue;
+        }
+        i++;
+    }
+}
+
+void Animator::cancel(TextInfoHandle target, AnimatedProperty property)
+{
+    for (size_t i = 0; i < animations.size(); i++)
+    {
+        if (animations[i].target == target && animations[i].property == property)
+        {
+            animations[i] = animations.back();
+            animations.pop_back();
+            return;
+        }
+    }
+}
+
+bool Animator::isIdle() const
+{
+    return animations.empty();
+}
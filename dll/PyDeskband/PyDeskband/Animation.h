@@ -0,0 +1,90 @@
+#pragma once
+
+#include "TextInfoStore.h"
+
+#include <Windows.h>
+#include <vector>
+
+// Animations running at once, across every TextInfo. SET,ANIMATION fails past this.
+#define ANIMATION_MAX_ANIMATIONS 256
+#define ANIMATION_MAX_VALUES 3
+
+// How an animation's progress (0 to 1 over its duration) maps to how far its values have moved
+enum class Easing
+{
+    Linear = 0,
+    EaseIn = 1,
+    EaseOut = 2,
+    EaseInOut = 3,
+};
+
+// What an animation moves, and its values
+enum class AnimatedProperty
+{
+    // red, green, blue
+    Rgb = 0,
+    // x, y. Like SET,XY, it ends the TextInfo's layout.
+    XY = 1,
+    // the text, as a number counting towards the target (in units of 10^-decimals)
+    Value = 2,
+};
+
+struct Animation
+{
+    TextInfoHandle target = 0;
+    AnimatedProperty property = AnimatedProperty::Rgb;
+    Easing easing = Easing::Linear;
+    ULONGLONG startMs = 0;
+    ULONGLONG durationMs = 0;
+    double from[ANIMATION_MAX_VALUES] = { 0 };
+    double to[ANIMATION_MAX_VALUES] = { 0 };
+    // VALUE: digits shown after the decimal point
+    int decimals = 0;
+};
+
+// progress eased, both from 0 to 1
+double applyEasing(Easing easing, double progress);
+
+// The running animations (pipe thread only). They're stepped once per frame of the repaint scheduler, and only while
+// there are any, so an idle band has no timer ticking.
+class Animator
+{
+public:
+    // Replaces any animation of the same property on the same TextInfo. False if ANIMATION_MAX_ANIMATIONS are running.
+    bool start(const Animation& animation);
+    // Stops the TextInfo's animations where they are
+    void cancel(TextInfoHandle target);
+    void cancel(TextInfoHandle target, AnimatedProperty property);
+    bool isIdle() const;
+
+    // Moves every animation to where it is at now, calling apply(animation, values) for each. Those that finished,
+    // or that apply returns false for (their TextInfo is gone), are removed.
+    template <typename F>
+    void step(ULONGLONG now, F apply)
+    {
+        double values[ANIMATION_MAX_VALUES];
+        for (size_t i = 0; i < animations.size();)
+        {
+            auto& animation = animations[i];
+            auto elapsed = now - animation.startMs;
+            bool finished = elapsed >= animation.durationMs;
+            auto eased = finished ? 1.0 : applyEasing(animation.easing, (double)elapsed / animation.durationMs);
+            for (size_t v = 0; v < ANIMATION_MAX_VALUES; v++)
+            {
+                values[v] = animation.from[v] + (animation.to[v] - animation.from[v]) * eased;
+            }
+
+            if (!apply(animation, values) || finished)
+            {
+                // order doesn't matter, so the last one fills the gap
+                animation = animations.back();
+                animations.pop_back();
+                continue;
+            }
+            i++;
+        }
+    }
+
+private:
+    std::vector<Animation> animations;
+};
@@ -0,0 +1,216 @@
+#include "BackBuffer.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+BackBuffer::BackBuffer() :
+    hdc(NULL), hBitmap(NULL), hOldBitmap(NULL), pixels(NULL), width(0), height(0)
+{
+}
+
+BackBuffer::~BackBuffer()
+{
+    release();
+}
+
+bool BackBuffer::resize(HDC hdcReference, LONG width, LONG height)
+{
+    if (isValid() && width == this->width && height == this->height)
+    {
+        return false;
+    }
+
+    release();
+    if (width <= 0 || height <= 0)
+    {
+        return true;
+    }
+
+    BITMAPINFO bitmapInfo = { 0 };
+    bitmapInfo.bmiHeader.biSize = sizeof(bitmapInfo.bmiHeader);
+    bitmapInfo.bmiHeader.biWidth = width;
+    bitmapInfo.bmiHeader.biHeight = -height; // top-down
+    bitmapInfo.bmiHeader.biPlanes = 1;
+    bitmapInfo.bmiHeader.biBitCount = 32;
+    bitmapInfo.bmiHeader.biCompression = BI_RGB;
+
+    hdc = CreateCompatibleDC(hdcReference);
+    hBitmap = CreateDIBSection(hdc, &bitmapInfo, DIB_RGB_COLORS, reinterpret_cast<void**>(&pixels), NULL, 0);
+    if (!hdc || !hBitmap)
+    {
+        log(LogLevel::Error, "Failed to create back buffer of size: " + std::to_string(width) + "x" + std::to_string(height));
+        release();
+        return true;
+    }
+
+    hOldBitmap = SelectObject(hdc, hBitmap);
+    this->width = width;
+    this->height = height;
+
+    // CreateDIBSection zero fills, so this starts out fully transparent
+    return true;
+}
+
+void BackBuffer::clear(const RECT& rect)
+{
+    RECT clipped;
+    if (!clipToSurface(rect, clipped))
+    {
+        return;
+    }
+
+    // make sure GDI is done with the bits before touching them
+    GdiFlush();
+    for (LONG y = clipped.top; y < clipped.bottom; y++)
+    {
+        memset(pixels + (y * width) + clipped.left, 0, (clipped.right - clipped.left) * sizeof(DWORD));
+    }
+}
+
+void BackBuffer::compositeTo(HDC hdcDest, const RECT& rect) const
+{
+    RECT clipped;
+    if (!clipToSurface(rect, clipped))
+    {
+        return;
+    }
+
+    BLENDFUNCTION blendFunction = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+    auto clippedWidth = clipped.right - clipped.left;
+    auto clippedHeight = clipped.bottom - clipped.top;
+    AlphaBlend(hdcDest, clipped.left, clipped.top, clippedWidth, clippedHeight,
+        hdc, clipped.left, clipped.top, clippedWidth, clippedHeight,
+        blendFunction);
+}
+
+void BackBuffer::copyTo(DWORD* out, const RECT& rect) const
+{
+    RECT clipped;
+    if (!clipToSurface(rect, clipped) || !EqualRect(&clipped, &rect))
+    {
+        return;
+    }
+
+    GdiFlush();
+    auto rowWidth = rect.right - rect.left;
+    for (LONG y = rect.top; y < rect.bottom; y++)
+    {
+        memcpy(out + (y - rect.top) * rowWidth, pixels + (y * width) + rect.left, rowWidth * sizeof(DWORD));
+    }
+}
+
+void BackBuffer::blendFrom(const DWORD* source, LONG sourceWidth, LONG sourceHeight, LONG x, LONG y, const RECT& clip)
+{
+    RECT sourceRect = { x, y, x + sourceWidth, y + sourceHeight };
+    RECT visible;
+    RECT clipped;
+    if (!IntersectRect(&visible, &sourceRect, &clip) || !clipToSurface(visible, clipped))
+    {
+        return;
+    }
+
+    GdiFlush();
+    for (LONG row = clipped.top; row < clipped.bottom; row++)
+    {
+        const DWORD* from = source + (row - y) * sourceWidth + (clipped.left - x);
+        DWORD* to = pixels + (row * width) + clipped.left;
+        for (LONG column = clipped.left; column < clipped.right; column++, from++, to++)
+        {
+            // premultiplied source over: every channel is src + dst * (255 - src alpha) / 255
+            DWORD src = *from;
+            DWORD inverseAlpha = 255 - (src >> 24);
+            if (inverseAlpha == 255)
+            {
+                continue;
+            }
+            if (inverseAlpha == 0)
+            {
+                *to = src;
+                continue;
+            }
+
+            DWORD dst = *to;
+            DWORD blended = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                DWORD channel = ((src >> shift) & 0xFF) + (((dst >> shift) & 0xFF) * inverseAlpha + 127) / 255;
+                blended |= (channel > 255 ? 255 : channel) << shift;
+            }
+            *to = blended;
+        }
+    }
+}
+
+void BackBuffer::fillRect(const RECT& rect, COLORREF color, const RECT& clip)
+{
+    RECT visible;
+    RECT clipped;
+    if (!IntersectRect(&visible, &rect, &clip) || !clipToSurface(visible, clipped))
+    {
+        return;
+    }
+
+    // opaque, so premultiplying changes nothing. The surface is BGRA, COLORREF is 0x00BBGGRR.
+    DWORD pixel = 0xFF000000 | ((DWORD)GetRValue(color) << 16) | ((DWORD)GetGValue(color) << 8) | GetBValue(color);
+    GdiFlush();
+    for (LONG y = clipped.top; y < clipped.bottom; y++)
+    {
+        std::fill(pixels + (y * width) + clipped.left, pixels + (y * width) + clipped.right, pixel);
+    }
+}
+
+HDC BackBuffer::getDC() const
+{
+    return hdc;
+}
+
+bool BackBuffer::isValid() const
+{
+    return hdc && hBitmap && pixels;
+}
+
+LONG BackBuffer::getWidth() const
+{
+    return width;
+}
+
+LONG BackBuffer::getHeight() const
+{
+    return height;
+}
+
+void BackBuffer::release()
+{
+    if (hdc && hOldBitmap)
+    {
+        SelectObject(hdc, hOldBitmap);
+    }
+    if (hBitmap)
+    {
+        DeleteObject(hBitmap);
+    }
+    if (hdc)
+    {
+        DeleteDC(hdc);
+    }
+
+    hdc = NULL;
+    hBitmap = NULL;
+    hOldBitmap = NULL;
+    pixels = NULL;
+    width = 0;
+    height = 0;
+}
+
+bool BackBuffer::clipToSurface(const RECT& rect, RECT& clipped) const
+{
+    if (!isValid())
+    {
+        return false;
+    }
+
+    RECT surface = { 0, 0, width, height };
+    return IntersectRect(&clipped, &rect, &surface) != FALSE;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <windows.h>
+
+// A persistent, premultiplied 32bpp ARGB surface. Content is rendered into it only when it changes, then
+// composited on top of the (parent) background on every paint.
+class BackBuffer
+{
+public:
+    BackBuffer();
+    ~BackBuffer();
+
+    // (Re)creates the surface if the size changed. Returns true if the previous contents were lost.
+    bool resize(HDC hdcReference, LONG width, LONG height);
+
+    // Makes the given area fully transparent.
+    void clear(const RECT& rect);
+
+    // Alpha blends the given area of the surface onto the same area of hdc.
+    void compositeTo(HDC hdc, const RECT& rect) const;
+
+    // Copies the given area (which must be within the surface) into pixels, row by row.
+    void copyTo(DWORD* pixels, const RECT& rect) const;
+    // Alpha blends premultiplied pixels (width x height, row by row) onto the surface at x, y, only touching
+    // what falls within clip. Like compositeTo, but without going through GDI.
+    void blendFrom(const DWORD* pixels, LONG width, LONG height, LONG x, LONG y, const RECT& clip);
+
+    // Fills the part of rect within clip with an opaque color
+    void fillRect(const RECT& rect, COLORREF color, const RECT& clip);
+
+    HDC getDC() const;
+    bool isValid() const;
+    LONG getWidth() const;
+    LONG getHeight() const;
+
+private:
+    void release();
+    bool clipToSurface(const RECT& rect, RECT& clipped) const;
+
+    HDC hdc;
+    HBITMAP hBitmap;
+    HGDIOBJ hOldBitmap;
+    DWORD* pixels;
+    LONG width;
+    LONG height;
+};
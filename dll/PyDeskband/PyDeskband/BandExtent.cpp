@@ -0,0 +1,33 @@
+#include "BandExtent.h"
+
+BandExtent::BandExtent()
+{
+    width = 0;
+}
+
+bool BandExtent::update(LONG contentWidth, UINT dpi)
+{
+    dpi = dpi ? dpi : USER_DEFAULT_SCREEN_DPI;
+    LONG wanted = 0;
+    if (contentWidth > 0)
+    {
+        LONG step = MulDiv(BAND_EXTENT_STEP, dpi, USER_DEFAULT_SCREEN_DPI);
+        wanted = (contentWidth + step - 1) / step * step;
+    }
+
+    auto current = width.load();
+    bool grow = wanted > current;
+    bool shrink = wanted < current && (wanted == 0 || current - wanted >= MulDiv(BAND_EXTENT_HYSTERESIS, dpi, USER_DEFAULT_SCREEN_DPI));
+    if (!grow && !shrink)
+    {
+        return false;
+    }
+
+    width = wanted;
+    return true;
+}
+
+LONG BandExtent::getWidth() const
+{
+    return width;
+}
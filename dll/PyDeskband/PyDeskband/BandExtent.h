@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+
+// Posted to the deskband window when the band's width should be asked for again
+#define WM_BAND_EXTENT_CHANGED (WM_APP + 2)
+// In pixels at 96 DPI. Widths are rounded up to a multiple of the step, and only shrink once the content is narrower
+// than the reported width by at least the hysteresis.
+#define BAND_EXTENT_STEP 16
+#define BAND_EXTENT_HYSTERESIS 32
+
+// The width the band asks the taskbar for, following what its TextInfos need. Growing happens right away, since
+// the content would be clipped otherwise. Shrinking waits for a real drop, so a number whose width wobbles from
+// tick to tick doesn't make the taskbar lay itself out again every time.
+class BandExtent
+{
+public:
+    BandExtent();
+
+    // Pipe thread: the content now needs contentWidth pixels (0 if there isn't any). Returns true if the reported
+    // width changed, so the taskbar should be asked to query it again.
+    bool update(LONG contentWidth, UINT dpi);
+
+    // Any thread: the width to report, or 0 while there's no content (the band then keeps its default size)
+    LONG getWidth() const;
+
+private:
+    std::atomic<LONG> width;
+};
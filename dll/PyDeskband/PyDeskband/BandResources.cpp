@@ -0,0 +1,134 @@
+#include "BandResources.h"
+#include "Logger.h"
+
+#include <cstdlib>
+
+// Guards resources, never anything in it
+static std::mutex resourcesMutex;
+static std::weak_ptr<BandResources> resources;
+
+std::shared_ptr<BandResources> BandResources::acquire()
+{
+    std::lock_guard<std::mutex> lock(resourcesMutex);
+    auto shared = resources.lock();
+    if (!shared)
+    {
+        shared = std::shared_ptr<BandResources>(new BandResources());
+        resources = shared;
+    }
+    return shared;
+}
+
+BandResources::BandResources()
+{
+    factoriesUnavailable = false;
+}
+
+BandResources::~BandResources()
+{
+    // the last band is gone. Bands log from their pipe threads, which are stopped by now.
+    stopLogging();
+}
+
+int BandResources::claimInstanceId()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int id = 0; id < BAND_MAX_INSTANCES; id++)
+    {
+        if (instanceIds.insert(id).second)
+        {
+            return id;
+        }
+    }
+    return -1;
+}
+
+void BandResources::releaseInstanceId(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    instanceIds.erase(id);
+}
+
+ThemeHandle BandResources::getTheme(UINT dpi)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& theme = themes[dpi];
+    if (!theme)
+    {
+        auto hTheme = OpenThemeDataForDpi(NULL, L"BUTTON", dpi);
+        if (hTheme)
+        {
+            theme = ThemeHandle(hTheme, [](void* h) { CloseThemeData((HTHEME)h); });
+        }
+    }
+    return theme;
+}
+
+void BandResources::onThemeChanged()
+{
+    // every band gets WM_THEMECHANGED, so this runs once per band. Handles still in use are closed once let go of.
+    std::lock_guard<std::mutex> lock(mutex);
+    themes.clear();
+}
+
+bool BandResources::getFactories(Microsoft::WRL::ComPtr<ID2D1Factory>& outFactory, Microsoft::WRL::ComPtr<IDWriteFactory>& outWriteFactory)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!factory && !factoriesUnavailable)
+    {
+        auto hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, factory.GetAddressOf());
+        if (SUCCEEDED(hr))
+        {
+            hr = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(writeFactory.GetAddressOf()));
+        }
+        if (FAILED(hr))
+        {
+            log(LogLevel::Error, "Failed to initialize Direct2D: " + std::to_string(hr));
+            factory.Reset();
+            writeFactory.Reset();
+            factoriesUnavailable = true;
+        }
+    }
+
+    outFactory = factory;
+    outWriteFactory = writeFactory;
+    return !factoriesUnavailable;
+}
+
+Microsoft::WRL::ComPtr<IDWriteTextFormat> BandResources::getTextFormat(const LOGFONTW& logFont)
+{
+    auto weight = logFont.lfWeight ? (DWRITE_FONT_WEIGHT)logFont.lfWeight : DWRITE_FONT_WEIGHT_NORMAL;
+    auto style = logFont.lfItalic ? DWRITE_FONT_STYLE_ITALIC : DWRITE_FONT_STYLE_NORMAL;
+    auto size = logFont.lfHeight ? (FLOAT)abs(logFont.lfHeight) : 12.0f;
+    auto key = std::wstring(logFont.lfFaceName) + L"," + std::to_wstring(weight) + L"," + std::to_wstring(style) + L"," + std::to_wstring(size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writeFactory)
+    {
+        return nullptr;
+    }
+
+    auto& textFormat = textFormats[key];
+    if (!textFormat)
+    {
+        if (FAILED(writeFactory->CreateTextFormat(logFont.lfFaceName, NULL, weight, style, DWRITE_FONT_STRETCH_NORMAL, size, L"", textFormat.GetAddressOf())))
+        {
+            log(LogLevel::Error, "Failed to create DirectWrite text format");
+            textFormats.erase(key);
+            return nullptr;
+        }
+
+        // text is laid out in rects measured for it, so it must never wrap
+        textFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
+    }
+    return textFormat;
+}
+
+std::wstring instanceName(const wchar_t* name, int instanceId)
+{
+    if (instanceId == 0)
+    {
+        return name;
+    }
+    return std::wstring(name) + L"." + std::to_wstring(instanceId);
+}
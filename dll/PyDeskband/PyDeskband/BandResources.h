@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Windows.h>
+#include <uxtheme.h>
+#include <d2d1.h>
+#include <dwrite.h>
+#include <wrl/client.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+// Bands past this many in one process get no pipe
+#define BAND_MAX_INSTANCES 16
+
+// A theme handle that stays open for as long as anyone holds it, even once the theme changed
+typedef std::shared_ptr<void> ThemeHandle;
+
+// What every band in the process shares. Explorer makes a band per taskbar, and each would otherwise open the same
+// themes and create the same factories and fonts. Each band holds a reference from acquire(), and the last one to let
+// go frees everything (and stops the logger). Any thread.
+class BandResources
+{
+public:
+    static std::shared_ptr<BandResources> acquire();
+    ~BandResources();
+
+    // The lowest instance id no other band has, or -1 if BAND_MAX_INSTANCES are in use
+    int claimInstanceId();
+    void releaseInstanceId(int id);
+
+    // The BUTTON theme at dpi, opened the first time it's asked for. Empty if there's no theme.
+    ThemeHandle getTheme(UINT dpi);
+    // The theme changed, so themes are opened again as they're next asked for
+    void onThemeChanged();
+
+    // The factories are created the first time. Returns false if Direct2D isn't available.
+    bool getFactories(Microsoft::WRL::ComPtr<ID2D1Factory>& factory, Microsoft::WRL::ComPtr<IDWriteFactory>& writeFactory);
+    // A text format matching logFont, created the first time it's asked for. NULL if it can't be.
+    Microsoft::WRL::ComPtr<IDWriteTextFormat> getTextFormat(const LOGFONTW& logFont);
+
+private:
+    BandResources();
+
+    std::mutex mutex;
+    std::set<int> instanceIds;
+    std::map<UINT, ThemeHandle> themes;
+
+    // multithreaded, since bands needn't share a UI thread
+    Microsoft::WRL::ComPtr<ID2D1Factory> factory;
+    Microsoft::WRL::ComPtr<IDWriteFactory> writeFactory;
+    // creating the factories failed, so it isn't tried again
+    bool factoriesUnavailable;
+    std::map<std::wstring, Microsoft::WRL::ComPtr<IDWriteTextFormat>> textFormats;
+};
+
+// name for instance 0, so the first band keeps the names clients have always used. name.<id> for the others.
+std::wstring instanceName(const wchar_t* name, int instanceId);
@@ -0,0 +1,193 @@
+#include "BandState.h"
+
+#include <cstring>
+
+template <typename T>
+static void writeValue(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void writeText(std::string& out, const std::string& text)
+{
+    writeValue<uint32_t>(out, (uint32_t)text.size());
+    out += text;
+}
+
+// Reads values off the front of data. Once anything is missing, every read fails.
+class StateReader
+{
+public:
+    StateReader(std::string_view data) : data(data), ok(true)
+    {
+    }
+
+    template <typename T>
+    T read()
+    {
+        T value = T();
+        if (ok && data.size() >= sizeof(T))
+        {
+            memcpy(&value, data.data(), sizeof(T));
+            data.remove_prefix(sizeof(T));
+        }
+        else
+        {
+            ok = false;
+        }
+        return value;
+    }
+
+    std::string readText()
+    {
+        auto size = read<uint32_t>();
+        if (!ok || data.size() < size)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string text(data.substr(0, size));
+        data.remove_prefix(size);
+        return text;
+    }
+
+    bool isOk() const
+    {
+        return ok;
+    }
+
+private:
+    std::string_view data;
+    bool ok;
+};
+
+size_t BandState::sizeFromHeader(const char* header)
+{
+    StateReader reader(std::string_view(header, BAND_STATE_HEADER_SIZE));
+    if (reader.read<uint32_t>() != BAND_STATE_MAGIC || reader.read<uint16_t>() != BAND_STATE_VERSION)
+    {
+        return 0;
+    }
+    return BAND_STATE_HEADER_SIZE + reader.read<uint32_t>();
+}
+
+std::string BandState::serialize() const
+{
+    std::string body;
+    writeValue<uint32_t>(body, maxFps);
+    writeValue<uint8_t>(body, renderer);
+    writeValue<uint32_t>(body, textRunCacheEntries);
+
+    writeValue<uint32_t>(body, (uint32_t)textInfos.size());
+    for (auto& textInfo : textInfos)
+    {
+        writeValue<int32_t>(body, textInfo.rect.left);
+        writeValue<int32_t>(body, textInfo.rect.top);
+        writeValue<uint8_t>(body, (uint8_t)textInfo.red);
+        writeValue<uint8_t>(body, (uint8_t)textInfo.green);
+        writeValue<uint8_t>(body, (uint8_t)textInfo.blue);
+        writeText(body, textInfo.text);
+
+        auto& layout = textInfo.layout;
+        writeValue<uint8_t>(body, layout.enabled);
+        if (layout.enabled)
+        {
+            writeValue<int32_t>(body, layout.xPercent);
+            writeValue<int32_t>(body, layout.yPercent);
+            writeValue<int32_t>(body, layout.xOffset);
+            writeValue<int32_t>(body, layout.yOffset);
+            writeValue<uint8_t>(body, (uint8_t)layout.horizontal);
+            writeValue<uint8_t>(body, (uint8_t)layout.vertical);
+            writeValue<uint32_t>(body, layout.after);
+            writeValue<uint8_t>(body, (uint8_t)layout.flow);
+            writeValue<int32_t>(body, layout.gap);
+        }
+    }
+
+    writeValue<uint32_t>(body, (uint32_t)actions.size());
+    for (auto& action : actions)
+    {
+        writeValue<uint32_t>(body, action.msg);
+        writeValue<uint64_t>(body, action.debounceMs);
+        writeText(body, action.command);
+    }
+
+    std::string out;
+    writeValue<uint32_t>(out, BAND_STATE_MAGIC);
+    writeValue<uint16_t>(out, BAND_STATE_VERSION);
+    writeValue<uint32_t>(out, (uint32_t)body.size());
+    return out + body;
+}
+
+bool BandState::parse(std::string_view data)
+{
+    if (data.size() < BAND_STATE_HEADER_SIZE)
+    {
+        return false;
+    }
+    auto size = sizeFromHeader(data.data());
+    if (size == 0 || data.size() < size)
+    {
+        return false;
+    }
+
+    // read into a copy, so a bad state leaves this one alone
+    BandState state;
+    StateReader reader(data.substr(BAND_STATE_HEADER_SIZE, size - BAND_STATE_HEADER_SIZE));
+    state.maxFps = reader.read<uint32_t>();
+    state.renderer = reader.read<uint8_t>();
+    state.textRunCacheEntries = reader.read<uint32_t>();
+
+    auto textInfoCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < textInfoCount && reader.isOk(); i++)
+    {
+        TextInfo textInfo;
+        textInfo.rect.left = reader.read<int32_t>();
+        textInfo.rect.top = reader.read<int32_t>();
+        textInfo.red = reader.read<uint8_t>();
+        textInfo.green = reader.read<uint8_t>();
+        textInfo.blue = reader.read<uint8_t>();
+        textInfo.text = reader.readText();
+
+        auto& layout = textInfo.layout;
+        layout.enabled = reader.read<uint8_t>() != 0;
+        if (layout.enabled)
+        {
+            layout.xPercent = reader.read<int32_t>();
+            layout.yPercent = reader.read<int32_t>();
+            layout.xOffset = reader.read<int32_t>();
+            layout.yOffset = reader.read<int32_t>();
+            auto horizontal = reader.read<uint8_t>();
+            auto vertical = reader.read<uint8_t>();
+            layout.after = reader.read<uint32_t>();
+            auto flow = reader.read<uint8_t>();
+            layout.gap = reader.read<int32_t>();
+            if (horizontal > (uint8_t)LayoutAlign::End || vertical > (uint8_t)LayoutAlign::End || flow > (uint8_t)LayoutFlow::Below
+                || layout.after > textInfoCount)
+            {
+                return false;
+            }
+            layout.horizontal = (LayoutAlign)horizontal;
+            layout.vertical = (LayoutAlign)vertical;
+            layout.flow = (LayoutFlow)flow;
+        }
+        state.textInfos.push_back(std::move(textInfo));
+    }
+
+    auto actionCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < actionCount && reader.isOk(); i++)
+    {
+        SavedAction action;
+        action.msg = reader.read<uint32_t>();
+        action.debounceMs = reader.read<uint64_t>();
+        action.command = reader.readText();
+        state.actions.push_back(std::move(action));
+    }
+
+    if (!reader.isOk())
+    {
+        return false;
+    }
+    *this = std::move(state);
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "TextInfoStore.h"
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define BAND_STATE_MAGIC 0x53424450 // "PDBS"
+#define BAND_STATE_VERSION 1
+// magic, version and the length of the rest
+#define BAND_STATE_HEADER_SIZE 10
+// Explorer keeps the band's stream in the registry, so anything bigger is neither saved nor loaded
+#define BAND_STATE_MAX_SIZE (1024 * 256)
+
+// A window message action, as set by SET,WIN_MSG
+struct SavedAction
+{
+    DWORD msg = 0;
+    std::string command;
+    ULONGLONG debounceMs = 0;
+};
+
+// What the band keeps across explorer restarts through IPersistStream, so clients only need to send what changed
+// since. Encoded little-endian as: uint32 magic, uint16 version, uint32 length of the rest, then the settings, the
+// TextInfos and the actions (each list prefixed with a uint32 count, strings with a uint32 length).
+struct BandState
+{
+    unsigned maxFps = 0;
+    // as for SET,RENDERER
+    uint8_t renderer = 0;
+    uint32_t textRunCacheEntries = 0;
+
+    // Just what describes them (text, position, color, layout). Handles don't survive a restart, so layout.after is
+    // the index of the followed TextInfo in textInfos plus 1 (0 for none) instead.
+    std::vector<TextInfo> textInfos;
+    std::vector<SavedAction> actions;
+
+    // The whole size of a state starting with header (BAND_STATE_HEADER_SIZE bytes), or 0 if it isn't one we can read
+    static size_t sizeFromHeader(const char* header);
+
+    std::string serialize() const;
+    // False if data isn't a state this version can read (or is cut short), in which case nothing is restored
+    bool parse(std::string_view data);
+};
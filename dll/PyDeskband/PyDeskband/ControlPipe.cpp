@@ -1,494 +1,2122 @@
 #include "ControlPipe.h"
 #include "DeskBand.h"
 #include "Logger.h"
+#include "Tracing.h"
+#include "Transport.h"
 
 #include <uxtheme.h>
+#include <cmath>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <string>
-#include <sstream>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include <codecvt>
-#include <locale>
 
-#define BUFFER_SIZE (1024 * 8)
-#define TRANSPORT_DELIM std::string(",")
+#define BATCH_DELIM '\n'
+#define BATCH_HEADER "BATCH"
+#define BATCH_MAX_COMMANDS 1024
+#define TEXT_GLOW_SIZE 10
+// TextInfos per GET,ALL reply. Larger sets take several, so no one reply gets too big to buffer. Each takes 7 fields
+// after the 3 up front, and it has to fit in a version 2 frame (36 of them) whatever version the reply is sent in.
+#define GET_ALL_MAX_TEXTINFOS ((TRANSPORT_MAX_RESPONSE_FIELDS - 3) / 7)
 
 
-std::vector<std::string> split(std::string s, char delim)
+// Text is UTF-8 on the wire and UTF-16 on screen. Invalid sequences become U+FFFD instead of throwing, which would
+// end the pipe thread (and explorer with it).
+std::wstring to_wstring(std::string str)
 {
-    std::vector<std::string> ret;
-    std::stringstream wStringStream(s);
-    while (wStringStream.good())
+    if (str.empty())
     {
-        std::string tmp;
-        std::getline(wStringStream, tmp, delim);
-        ret.push_back(tmp);
+        return std::wstring();
     }
-    return ret;
+    auto length = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), NULL, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &wide[0], length);
+    return wide;
 }
 
-std::wstring to_wstring(std::string str)
+std::string to_utf8(const std::wstring& str)
 {
-    using convert_t = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_t, wchar_t> strconverter;
-    return strconverter.from_bytes(str);
+    if (str.empty())
+    {
+        return std::string();
+    }
+    auto length = WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.size(), NULL, 0, NULL, NULL);
+    std::string utf8(length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.size(), &utf8[0], length, NULL, NULL);
+    return utf8;
 }
 
-ControlPipe::ControlPipe(CDeskBand* d)
+// The SETs that change the current TextInfo. They're the only commands that make one when there is none yet. Before
+// handles, every command did: a GET of the current TextInfo on an empty band read back a new, empty one. It now
+// replies TextInfoTargetInvalid, and GET,ALL (or GET,TEXTINFO_COUNT) on an empty band reports nothing.
+bool setsTextInfo(Opcode opcode)
+{
+    switch (opcode)
+    {
+    case Opcode::SetRgb:
+    case Opcode::SetText:
+    case Opcode::SetXY:
+    case Opcode::SetAnimation:
+    case Opcode::SetLayout:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The glow drawn around text reaches outside of the text's rect
+RECT glowRect(const RECT& rect)
 {
-    hPipe = CreateNamedPipe(TEXT("\\\\.\\pipe\\PyDeskbandControlPipe"),
-        PIPE_ACCESS_DUPLEX,
-        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
-        1,
-        BUFFER_SIZE,
-        BUFFER_SIZE,
-        NMPWAIT_USE_DEFAULT_WAIT,
-        NULL);
+    RECT ret = rect;
+    if (!IsRectEmpty(&ret))
+    {
+        ret.left -= TEXT_GLOW_SIZE;
+        ret.top -= TEXT_GLOW_SIZE;
+        ret.right += TEXT_GLOW_SIZE;
+        ret.bottom += TEXT_GLOW_SIZE;
+    }
+    return ret;
+}
 
+ControlPipe::ControlPipe(CDeskBand* d)
+{
     deskband = d;
     shouldStop = false;
+    fontChanged = false;
+    bandResized = false;
+    animating = false;
+    animationFrameDue = false;
+    stateChanged = false;
+    restorePending = false;
+    layoutDirty = false;
+    layoutsInUse = false;
+    contentDirty = false;
+    requestedBackend = RenderBackend::Gdi;
+    activeBackend = RenderBackend::Gdi;
+    sharedStateEnabled = false;
+    SetRectEmpty(&surfaceStaleRect);
+    SetRectEmpty(&pendingInvalidation);
+
+    // manual-reset, so the loop can't miss a stop request
+    hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    // An id whose name is already taken (by another process, or a band of ours on its way out) is skipped
+    std::vector<int> skippedIds;
+    for (;;)
+    {
+        instanceId = deskband->m_resources->claimInstanceId();
+        if (instanceId < 0)
+        {
+            log(LogLevel::Error, "No instance ids left for another band");
+            break;
+        }
+        if (createPipes())
+        {
+            break;
+        }
+        skippedIds.push_back(instanceId);
+    }
+    for (auto id : skippedIds)
+    {
+        deskband->m_resources->releaseInstanceId(id);
+    }
+
+    deskband->m_repaintScheduler.onTick = [this]()
+    {
+        pollSharedState();
+        if (animating && !animationFrameDue.exchange(true))
+        {
+            SetEvent(hWakeEvent);
+        }
+    };
 
     this->asyncResponseThread = std::thread(&ControlPipe::asyncHandlingLoop, this);
 }
 
-ControlPipe::~ControlPipe()
+bool ControlPipe::createPipes()
 {
-    CloseHandle(hPipe);
-    hPipe = INVALID_HANDLE_VALUE;
+    auto name = instanceName(PIPE_NAME, instanceId);
+    for (size_t i = 0; i < PIPE_MAX_CLIENTS; i++)
+    {
+        auto client = std::make_unique<PipeClient>();
+        // the first instance fails with ERROR_ACCESS_DENIED if anyone else already has the name
+        client->hPipe = CreateNamedPipeW(name.c_str(),
+            PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (i == 0 ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            // messages, so a write is never merged with another or split across reads however fast they come
+            PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+            PIPE_MAX_CLIENTS,
+            BUFFER_SIZE,
+            BUFFER_SIZE,
+            NMPWAIT_USE_DEFAULT_WAIT,
+            NULL);
+
+        if (client->hPipe == INVALID_HANDLE_VALUE)
+        {
+            auto error = GetLastError();
+            if (i == 0 && error == ERROR_ACCESS_DENIED)
+            {
+                LOG(LogLevel::Info, "Pipe for instance " + std::to_string(instanceId) + " is taken");
+                return false;
+            }
+            log(LogLevel::Error, "Failed to create pipe instance " + std::to_string(i) + ": " + std::to_string(error));
+            continue;
+        }
+
+        memset(&client->overlapped, 0, sizeof(client->overlapped));
+        client->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        client->state = PipeClient::State::Connecting;
+        client->ioPending = false;
+        client->transportVersion = TRANSPORT_VERSION_TEXT;
+        client->buffer.resize(BUFFER_SIZE);
+        client->received = 0;
+        client->oversized = false;
+        clients.push_back(std::move(client));
+    }
+
+    log("Band instance " + std::to_string(instanceId) + " listening");
+    return true;
 }
 
-DWORD ControlPipe::msgHandler(DWORD msg)
+ControlPipe::~ControlPipe()
 {
-    if (msgToAction.find(msg) != msgToAction.end())
+    deskband->m_repaintScheduler.onTick = nullptr;
+
+    if (asyncResponseThread.joinable())
+    {
+        stopAsyncResponseThread();
+    }
+
+    CloseHandle(hStopEvent);
+    hStopEvent = NULL;
+    CloseHandle(hWakeEvent);
+    hWakeEvent = NULL;
+
+    // the pipes are closed with the thread, so the id can go to the next band
+    if (instanceId >= 0)
     {
-        return system(msgToAction[msg].c_str());
+        deskband->m_resources->releaseInstanceId(instanceId);
     }
+}
+
+DWORD ControlPipe::msgHandler(DWORD msg)
+{
+    // The command runs on the dispatcher's worker, so the message still gets default handling
+    actions.dispatch(msg);
+    postEvent(EVENT_WIN_MSG, (int32_t)msg);
     return 0;
 }
 
 void ControlPipe::paintAllTextInfos()
 {
+    Stopwatch stopwatch;
     auto m_hwnd = deskband->m_hwnd;
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(m_hwnd, &ps);
+
+    PaintTraceActivity activity;
+    TraceLoggingWriteStart(activity, "Paint",
+        TraceLoggingInt32(ps.rcPaint.left, "Left"),
+        TraceLoggingInt32(ps.rcPaint.top, "Top"),
+        TraceLoggingInt32(ps.rcPaint.right, "Right"),
+        TraceLoggingInt32(ps.rcPaint.bottom, "Bottom"));
     RECT clientRectangle;
     GetClientRect(m_hwnd, &clientRectangle);
     HDC hdcPaint = NULL;
-    HPAINTBUFFER hBufferedPaint = BeginBufferedPaint(hdc, &clientRectangle, BPBF_TOPDOWNDIB, NULL, &hdcPaint);
-    DrawThemeParentBackground(m_hwnd, hdcPaint, &clientRectangle);
 
-    HTHEME hTheme = OpenThemeData(NULL, L"BUTTON");
+    // only what was invalidated needs to be redrawn
+    RECT paintRectangle;
+    IntersectRect(&paintRectangle, &ps.rcPaint, &clientRectangle);
 
-    for (auto& textInfo : textInfos)
+    TextInfoStore::Snapshot textInfos;
+    GraphStore::Snapshot graphs;
+    if (hdc)
     {
-        log("Painting: " + textInfo.toString());
-
-        if (hdc)
+        RECT staleRect;
         {
-            if (deskband->m_fCompositionEnabled)
-            {
-                if (hTheme)
-                {
-
-                    SIZE textSize = getTextSize(textInfo.text);
+            std::lock_guard<std::mutex> lock(surfaceStaleMutex);
+            staleRect = surfaceStaleRect;
+            SetRectEmpty(&surfaceStaleRect);
+        }
 
-                    DTTOPTS dttOpts = { sizeof(dttOpts) };
-                    dttOpts.dwFlags = DTT_COMPOSITED | DTT_TEXTCOLOR | DTT_GLOWSIZE;
-                    dttOpts.crText = RGB(textInfo.red, textInfo.green, textInfo.blue);
-                    dttOpts.iGlowSize = 10;
+        if (backBuffer.resize(hdc, RECTWIDTH(clientRectangle), RECTHEIGHT(clientRectangle)))
+        {
+            staleRect = clientRectangle;
+        }
 
-                    // textInfo.rect.left = (RECTWIDTH(clientRectangle) - textSize.cx) / 2;
-                    // textInfo.rect.top = (RECTHEIGHT(clientRectangle) - textSize.cy) / 2;
-                    textInfo.rect.right = textInfo.rect.left + textSize.cx;
-                    textInfo.rect.bottom = textInfo.rect.top + textSize.cy;
+        // nothing drawn by one backend is kept by another
+        auto backend = chooseRenderBackend();
+        if (backend != activeBackend)
+        {
+            activeBackend = backend;
+            staleRect = clientRectangle;
+        }
 
-                    auto w = to_wstring(textInfo.text);
-                    DrawThemeTextEx(hTheme, hdcPaint, 0, 0, w.c_str(), -1, 0, &textInfo.rect, &dttOpts);
-                }
-            }
-            else
-            {
-                abort();
-                /*
-                auto w = to_wstring(textInfo.text);
+        // Taken after the stale area: anything that made it stale has been published by now.
+        // Only text that changed since the last paint gets laid out and drawn again.
+        textInfos = textInfoStore.snapshot();
+        graphs = graphStore.snapshot();
+        renderStaleArea(*textInfos, *graphs, staleRect);
+    }
 
-                SetBkColor(hdc, RGB(textInfo.red, textInfo.green, textInfo.blue));
-                GetTextExtentPointA(hdc, textInfo.text.c_str(), (int)textInfo.text.size(), &size);
-                TextOutW(hdc,
-                    (RECTWIDTH(rc) - size.cx) / 2,
-                    (RECTHEIGHT(rc) - size.cy) / 2,
-                    w.c_str(),
-                    (int)w.size());
-                */
-            }
+    // Everything else (hovering, explorer redrawing the taskbar, etc) is just the background plus a blit.
+    HPAINTBUFFER hBufferedPaint = BeginBufferedPaint(hdc, &paintRectangle, BPBF_TOPDOWNDIB, NULL, &hdcPaint);
+    if (hBufferedPaint)
+    {
+        DrawThemeParentBackground(m_hwnd, hdcPaint, &paintRectangle);
+        backBuffer.compositeTo(hdcPaint, paintRectangle);
+        if (activeBackend == RenderBackend::Uncomposited && textInfos && graphs)
+        {
+            paintUncomposited(hdcPaint, paintRectangle, *textInfos, *graphs);
         }
+        EndBufferedPaint(hBufferedPaint, TRUE);
     }
 
-    CloseThemeData(hTheme);
-    EndBufferedPaint(hBufferedPaint, TRUE);
     EndPaint(m_hwnd, &ps);
-}
+    TraceLoggingWriteStop(activity, "Paint");
 
-void ControlPipe::stopAsyncResponseThread()
-{
-    sendStopMessageToAsyncResponseThread();
-    this->asyncResponseThread.join();
+    stats.paints++;
+    stats.paintUs.record(stopwatch.elapsedUs());
 }
 
-void ControlPipe::asyncHandlingLoop()
+void ControlPipe::renderStaleArea(const TextInfoStore::TextInfos& textInfos, const GraphStore::Items& graphs, const RECT& staleRect)
 {
-    log("Starting loop");
+    if (IsRectEmpty(&staleRect) || !backBuffer.isValid())
+    {
+        return;
+    }
+
+    HDC hdcSurface = backBuffer.getDC();
+    backBuffer.clear(staleRect);
 
-    char buffer[BUFFER_SIZE] = { 0 };
-    DWORD dwRead;
+    // Without composition the surface stays empty: text is drawn on every paint, by paintUncomposited
+    if (activeBackend == RenderBackend::Uncomposited)
+    {
+        return;
+    }
+
+    // Graphs go under the text. They're just solid spans, so both backends fill them straight into the surface.
+    for (auto& graph : graphs)
+    {
+        RECT overlap;
+        if (!IntersectRect(&overlap, &graph.rect, &staleRect))
+        {
+            continue;
+        }
+
+        graph.layout(graphSpans);
+        for (auto& span : graphSpans)
+        {
+            backBuffer.fillRect(span, RGB(graph.red, graph.green, graph.blue), staleRect);
+        }
+    }
+
+    bool direct2D = activeBackend == RenderBackend::Direct2D && d2dRenderer.begin(hdcSurface, staleRect);
+
+    // Text crossing the edge of the stale area gets drawn again. Clip it so its glow isn't blended a second time
+    // onto the pixels outside of the area, which are still there from before.
+    IntersectClipRect(hdcSurface, staleRect.left, staleRect.top, staleRect.right, staleRect.bottom);
 
-    while (hPipe != INVALID_HANDLE_VALUE)
+    // shared with the process's other bands at this DPI. Held until we're done, even if the theme changes meanwhile.
+    auto theme = deskband->m_resources->getTheme(deskband->m_dpi);
+    HTHEME hTheme = (HTHEME)theme.get();
+
+    // the pipe's TextInfos, then the shared state slots on top
+    const TextInfoStore::TextInfos* lists[] = { &textInfos, &sharedTextInfos };
+    for (auto list : lists)
     {
-        // will wait for a connection
-        if (ConnectNamedPipe(hPipe, NULL) != FALSE)
+        for (auto& textInfo : *list)
         {
-            while (ReadFile(hPipe, buffer, sizeof(buffer) - 1, &dwRead, NULL) != FALSE)
+            RECT textGlowRect = glowRect(textInfo.rect);
+            RECT overlap;
+            if (!IntersectRect(&overlap, &textGlowRect, &staleRect))
             {
-                /* add terminating zero */
-                buffer[dwRead] = '\0';
-                std::string sBuffer((char*)buffer);
-                log("Request: " + sBuffer);
+                continue;
+            }
 
-                std::string response = processRequest(sBuffer);
-                log("Response: " + response);
+            LOG(LogLevel::Verbose, "Painting: " + textInfo.toString());
 
-                if (response.size())
+            if (direct2D)
+            {
+                d2dRenderer.drawText(textInfo);
+            }
+            else if (hTheme)
+            {
+                // drawn once, then blended from the cache while the text and color stay the same
+                COLORREF color = RGB(textInfo.red, textInfo.green, textInfo.blue);
+                auto run = textRunCache.find(textInfo.wideText, color, textInfo.textSize);
+                if (!run && textRunCache.isEnabled())
                 {
-                    bool out = WriteFile(hPipe,
-                        response.data(),
-                        (DWORD)(response.size()),
-                        &dwRead,
-                        NULL);
+                    run = renderTextRun(hTheme, textInfo, color);
                 }
 
-                if (shouldStop)
+                if (run)
                 {
-                    log("Detected stop condition");
-                    CloseHandle(hPipe);
-                    hPipe = INVALID_HANDLE_VALUE;
-                    break;
+                    backBuffer.blendFrom(run->pixels.data(), run->width, run->height, textGlowRect.left, textGlowRect.top, staleRect);
+                }
+                else
+                {
+                    drawText(hTheme, hdcSurface, textInfo, color, textInfo.rect);
                 }
             }
         }
-        DisconnectNamedPipe(hPipe);
     }
 
-    log("Exited loop");
+    if (direct2D)
+    {
+        d2dRenderer.end();
+    }
+    SelectClipRgn(hdcSurface, NULL);
 }
 
-void ControlPipe::sendStopMessageToAsyncResponseThread()
+void ControlPipe::paintUncomposited(HDC hdc, const RECT& paintRect, const TextInfoStore::TextInfos& textInfos, const GraphStore::Items& graphs)
 {
-    // tell async thread to stop. In the async thread, we're probably stuck in ReadFile. Tell that thread to stop it.
-    // If we don't stop that thread, explorer will crash when we try to unload.
-    HANDLE hPipe = CreateFile(
-        TEXT("\\\\.\\pipe\\PyDeskbandControlPipe"), 
-        GENERIC_WRITE,
-        0,              
-        NULL,           
-        OPEN_EXISTING,  
-        0,              
-        NULL);         
-
-    if (hPipe != INVALID_HANDLE_VALUE)
+    for (auto& graph : graphs)
     {
-        DWORD bytesWritten = 0;
-
-        const char* stop = "STOP";
-
-        BOOL fSuccess = WriteFile(
-            hPipe,            // pipe handle 
-            stop,             // message 
-            sizeof(stop),     // message length 
-            &bytesWritten,    // bytes written 
-            NULL);
+        RECT overlap;
+        if (!IntersectRect(&overlap, &graph.rect, &paintRect))
+        {
+            continue;
+        }
 
-        if (!fSuccess) 
+        HBRUSH hBrush = CreateSolidBrush(RGB(graph.red, graph.green, graph.blue));
+        graph.layout(graphSpans);
+        for (auto& span : graphSpans)
         {
-            log("Failed to write STOP to the pipe");
+            RECT visible;
+            if (IntersectRect(&visible, &span, &paintRect))
+            {
+                FillRect(hdc, &visible, hBrush);
+            }
         }
+        DeleteObject(hBrush);
+    }
 
-        CloseHandle(hPipe);
+    // plain GDI text straight onto the window: there's no glass to blend with, so there's no glow either
+    SetBkMode(hdc, TRANSPARENT);
+    const TextInfoStore::TextInfos* lists[] = { &textInfos, &sharedTextInfos };
+    for (auto list : lists)
+    {
+        for (auto& textInfo : *list)
+        {
+            RECT overlap;
+            if (!IntersectRect(&overlap, &textInfo.rect, &paintRect))
+            {
+                continue;
+            }
+
+            SetTextColor(hdc, RGB(textInfo.red, textInfo.green, textInfo.blue));
+            ExtTextOutW(hdc, textInfo.rect.left, textInfo.rect.top, ETO_CLIPPED, &paintRect,
+                textInfo.wideText.c_str(), (UINT)textInfo.wideText.size(), NULL);
+        }
     }
 }
 
-class TextInfoNullException : public std::exception
+RenderBackend ControlPipe::chooseRenderBackend()
 {
-    using std::exception::exception;
-};
+    if (!deskband->m_fCompositionEnabled)
+    {
+        return RenderBackend::Uncomposited;
+    }
+    if (requestedBackend == RenderBackend::Direct2D && d2dRenderer.initialize(*deskband->m_resources))
+    {
+        return RenderBackend::Direct2D;
+    }
+    return RenderBackend::Gdi;
+}
 
-TextInfo* verifyTextInfo(TextInfo* textInfo)
+void ControlPipe::onCompositionChanged()
 {
-    if (textInfo == NULL)
-    { 
-        throw TextInfoNullException("TextInfo was NULL");
-    }
-    return textInfo;
+    // the next paint picks the backend for the new state, and renders everything with it
+    RECT clientRectangle = { 0 };
+    GetClientRect(deskband->m_hwnd, &clientRectangle);
+    invalidate(clientRectangle);
+
+    postEvent(EVENT_COMPOSITION, deskband->m_fCompositionEnabled ? 1 : 0);
 }
 
-std::string ControlPipe::processRequest(std::string message)
+void ControlPipe::onSizeChanged(int32_t width, int32_t height)
 {
-    // std::string ret = "BadCommand";
-    auto lineSplit = split(message, TRANSPORT_DELIM[0]);
+    postEvent(EVENT_SIZE, width, height);
 
-    // Do not use __textInfo directly... it may be NULL. Use GET_TEXT_INFO, which will throw if NULL.
-    auto __textInfo = getTextInfoTarget();
-    #define GET_TEXT_INFO() verifyTextInfo(__textInfo)
+    // layouts are relative to the band's size. The pipe thread owns the TextInfos, so it resolves them again.
+    bandResized = true;
+    SetEvent(hWakeEvent);
+}
 
-    Response response;
-    
-    try
+void ControlPipe::postEvent(uint32_t type, int32_t value0, int32_t value1)
+{
+    if (eventQueue.post({ type, { value0, value1 } }))
     {
-        if (lineSplit.size())
-        {
-            if (lineSplit[0] == "GET")
-            {
-                if (lineSplit[1] == "WIDTH")
-                {
-                    RECT rc;
-                    GetClientRect(deskband->m_hwnd, &rc);
-                    response.addField(std::to_string(rc.right - rc.left));
-                }
-                else if (lineSplit[1] == "HEIGHT")
-                {
-                    RECT rc;
-                    GetClientRect(deskband->m_hwnd, &rc);
-                    response.addField(std::to_string(rc.bottom - rc.top));
-                }
-                else if (lineSplit[1] == "TEXTSIZE")
-                {
-                    auto size = getTextSize(lineSplit[2]);
-                    response.addField(std::to_string(size.cx));
-                    response.addField(std::to_string(size.cy));
-                }
-                else if (lineSplit[1] == "TEXTINFOCOUNT")
-                {
-                    response.addField(std::to_string(textInfos.size()));
-                }
-                else if (lineSplit[1] == "TEXTINFO_TARGET")
-                {
-                    if (textInfoTarget)
-                    {
-                        response.addField(std::to_string(*textInfoTarget));
-                    }
-                    else
-                    {
-                        response.addField("None");
-                    }
-                }
-                else if (lineSplit[1] == "RGB")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    response.addField(std::to_string(textInfo->red));
-                    response.addField(std::to_string(textInfo->green));
-                    response.addField(std::to_string(textInfo->blue));
-                }
-                else if (lineSplit[1] == "TEXT")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    response.addField(textInfo->text);
-                }
-                else if (lineSplit[1] == "XY")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    response.addField(std::to_string(textInfo->rect.left));
-                    response.addField(std::to_string(textInfo->rect.top));
-                }
-                else if (lineSplit[1] == "TRANSPORT_VERSION")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    response.addField("1");
-                }
-            }
-            else if (lineSplit[0] == "SET")
-            {
-                if (lineSplit[1] == "RGB")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    textInfo->red = std::stoi(lineSplit[2]);
-                    textInfo->green = std::stoi(lineSplit[3]);
-                    textInfo->blue = std::stoi(lineSplit[4]);
-                    response.setOk();
-                }
-                else if (lineSplit[1] == "TEXT")
-                {
-                    auto textInfo = GET_TEXT_INFO();
-                    textInfo->text = std::string(lineSplit[2]);
-                    response.setOk();
-                }
-                else if (lineSplit[1] == "XY")
-                {
-                    auto textInfo = GET_TEXT_INFO();
+        SetEvent(hWakeEvent);
+    }
+}
 
-                    // xy from top left
-                    textInfo->rect.left = std::stol(lineSplit[2]);
-                    textInfo->rect.top = std::stol(lineSplit[3]);
-                    response.setOk();
-                }
-                else if (lineSplit[1] == "WIN_MSG")
-                {
-                    // set a (not already handled) Windows Message control to call something
-                    auto msg = std::stoi(lineSplit[2]);
-                    if (lineSplit.size() < 4)
-                    {
-                        if (msgToAction.find(msg) != msgToAction.end())
-                        {
-                            msgToAction.erase(msg);
-                            response.setOk();
-                        }
-                        else
-                        {
-                            response.setStatus("MSG_NOT_FOUND");
-                        }
-                    }
-                    else
-                    {
-                        auto sysCall = std::string(lineSplit[3]);
-                        msgToAction[msg] = sysCall;
-                        response.setOk();
-                    }
-                }
-                else if (lineSplit[1] == "TEXTINFO_TARGET")
-                {
-                    if (lineSplit.size() == 3)
-                    {
-                        textInfoTarget = (size_t)std::stoull(lineSplit[2]);
-                        log("Set textInfoTarget to: " + std::to_string(*textInfoTarget));
-                    }
-                    else
-                    {
-                        textInfoTarget.reset();
-                        log("Set textInfoTarget to: <reset>");
-                    }
-                    response.setOk();
-                }
-                else if (lineSplit[1] == "LOGGING_ENABLED")
-                {
-                    setLoggingEnabled((bool)std::stoi(lineSplit[2]));
-                    response.setOk();
-                }
-            }
-            else if (lineSplit[0] == "NEW_TEXTINFO")
-            {
-                textInfos.push_back(TextInfo());
-                response.setOk();
-            }
-            else if (lineSplit[0] == "PAINT")
-            {
-                InvalidateRect(deskband->m_hwnd, NULL, true);
-                response.setOk();
-            }
-            else if (lineSplit[0] == "CLEAR")
-            {
-                textInfos.clear();
-                InvalidateRect(deskband->m_hwnd, NULL, true);
-                response.setOk();
-            }
-            else if (lineSplit[0] == "STOP")
-            {
-                shouldStop = true;
-                response.setOk();
-            }
-            else if (lineSplit[0] == "SENDMESSAGE")
-            {
-                SendMessage(deskband->m_hwnd, std::stoi(lineSplit[1]), 0, 0);
-                response.setOk();
-            }
-        }
+const TextRun* ControlPipe::renderTextRun(HTHEME hTheme, const TextInfo& textInfo, COLORREF color)
+{
+    // Drawn on its own in the corner of a scratch surface, which only ever grows. The run covers the glow too.
+    RECT area = { 0, 0, textInfo.textSize.cx + 2 * TEXT_GLOW_SIZE, textInfo.textSize.cy + 2 * TEXT_GLOW_SIZE };
+    if (area.right > textRunSurface.getWidth() || area.bottom > textRunSurface.getHeight())
+    {
+        auto width = area.right > textRunSurface.getWidth() ? area.right : textRunSurface.getWidth();
+        auto height = area.bottom > textRunSurface.getHeight() ? area.bottom : textRunSurface.getHeight();
+        textRunSurface.resize(backBuffer.getDC(), width, height);
     }
-    catch (TextInfoNullException)
+    if (!textRunSurface.isValid())
     {
-        response.setStatus("TextInfoTargetInvalid");
+        return NULL;
     }
 
-    return response.toString();
+    textRunSurface.clear(area);
+    RECT textRect = { TEXT_GLOW_SIZE, TEXT_GLOW_SIZE, TEXT_GLOW_SIZE + textInfo.textSize.cx, TEXT_GLOW_SIZE + textInfo.textSize.cy };
+    drawText(hTheme, textRunSurface.getDC(), textInfo, color, textRect);
+    return textRunCache.insert(textInfo.wideText, color, textInfo.textSize, textRunSurface, area);
 }
 
-SIZE ControlPipe::getTextSize(const std::string& text)
+void ControlPipe::drawText(HTHEME hTheme, HDC hdc, const TextInfo& textInfo, COLORREF color, RECT textRect)
 {
-    HDC dc = GetDC(deskband->m_hwnd);
-    SIZE sz = { 0 };
-    GetTextExtentPoint32A(dc, text.c_str(), (int)text.size(), &sz);
-    ReleaseDC(deskband->m_hwnd, dc);
-    return sz;
+    DTTOPTS dttOpts = { sizeof(dttOpts) };
+    dttOpts.dwFlags = DTT_COMPOSITED | DTT_TEXTCOLOR | DTT_GLOWSIZE;
+    dttOpts.crText = color;
+    dttOpts.iGlowSize = TEXT_GLOW_SIZE;
+
+    Stopwatch drawStopwatch;
+    DrawTextTraceActivity drawActivity;
+    TraceLoggingWriteStart(drawActivity, "DrawThemeTextEx", TraceLoggingUInt32((UINT32)textInfo.wideText.size(), "Length"));
+    DrawThemeTextEx(hTheme, hdc, 0, 0, textInfo.wideText.c_str(), (int)textInfo.wideText.size(), 0, &textRect, &dttOpts);
+    TraceLoggingWriteStop(drawActivity, "DrawThemeTextEx");
+    stats.drawTextUs.record(drawStopwatch.elapsedUs());
 }
 
-TextInfo* ControlPipe::getTextInfoTarget()
+void ControlPipe::invalidate(const RECT& rect)
 {
-    if (textInfos.size() == 0)
+    // Can be called from either thread. The pipe thread must only call it once the changes are published.
+    if (IsRectEmpty(&rect))
+    {
+        return;
+    }
+
     {
-        textInfos.push_back(TextInfo());
+        std::lock_guard<std::mutex> lock(surfaceStaleMutex);
+        UnionRect(&surfaceStaleRect, &surfaceStaleRect, &rect);
     }
+    // coalesced with any other requests into at most one paint per frame
+    deskband->m_repaintScheduler.requestRepaint(rect);
+}
+
+void ControlPipe::onFontChanged()
+{
+    // The new theme may draw text differently, so all of it is stale (cached runs included)
+    textRunCache.clear();
+    d2dRenderer.resetFont();
+    RECT clientRectangle;
+    GetClientRect(deskband->m_hwnd, &clientRectangle);
+    invalidate(clientRectangle);
 
-    // get a ref to the last text info
-    auto textInfo = &textInfos[textInfos.size() - 1];
+    // cached text sizes were measured with the old font. The pipe thread owns the TextInfos, so it measures them again.
+    fontChanged = true;
+    SetEvent(hWakeEvent);
 
-    // swap that ref if textInfoTarget is set.
-    if (textInfoTarget)
+    for (auto& textInfo : sharedTextInfos)
     {
-        if (*textInfoTarget < textInfos.size())
-        {
-            textInfo = &textInfos[*textInfoTarget];
-        }
-        else
+        if (!IsRectEmpty(&textInfo.rect))
         {
-            log("Out of bounds text info target: " + std::to_string(*textInfoTarget));
-            textInfo = NULL;
+            measureTextInfo(textInfo);
         }
     }
+}
 
-    return textInfo;
+void ControlPipe::remeasureTextInfos()
+{
+    textInfoStore.forEach([this](TextInfo& textInfo) { measureTextInfo(textInfo); });
+    markLayoutDirty();
+    auto dirtyRect = collectDirtyRect(false);
+    UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+    publishChanges();
 }
 
-std::string TextInfo::toString()
+void ControlPipe::stepAnimations()
 {
-    std::string retString = "";
-    retString += "TextInfo\n";
-    retString += "  Red:      " + std::to_string(red) + "\n";
-    retString += "  Green:    " + std::to_string(green) + "\n";
-    retString += "  Blue:     " + std::to_string(blue) + "\n";
-    retString += "  Rect:\n";
-    retString += "    Left:   " + std::to_string(rect.left) + "\n";
-    retString += "    Top:    " + std::to_string(rect.top) + "\n";
-    retString += "    Right:  " + std::to_string(rect.right) + "\n";
-    retString += "    Bottom: " + std::to_string(rect.bottom) + "\n";
-    retString += "  Text:     " + text + "\n";
-    return retString;
+    animator.step(GetTickCount64(), [this](const Animation& animation, const double* values)
+    {
+        auto textInfo = textInfoStore.edit(animation.target);
+        if (!textInfo)
+        {
+            return false;
+        }
+        applyAnimation(*textInfo, animation, values);
+        return true;
+    });
+
+    // only the animating TextInfos were edited, so only they are painted again
+    auto dirtyRect = collectDirtyRect(false);
+    UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+    publishChanges();
+
+    if (animator.isIdle())
+    {
+        // nothing is moving, so the scheduler stops ticking for us
+        animating = false;
+        deskband->m_repaintScheduler.setPolling(REPAINT_POLL_ANIMATION, false);
+    }
 }
 
-Response::Response()
+void ControlPipe::applyAnimation(TextInfo& textInfo, const Animation& animation, const double* values)
 {
-    status = "BadCommand";
+    switch (animation.property)
+    {
+    case AnimatedProperty::Rgb:
+        textInfo.red = (unsigned)lround(values[0]);
+        textInfo.green = (unsigned)lround(values[1]);
+        textInfo.blue = (unsigned)lround(values[2]);
+        textInfo.dirty = true;
+        break;
+    case AnimatedProperty::XY:
+        textInfo.rect.left = lround(values[0]);
+        textInfo.rect.top = lround(values[1]);
+        textInfo.layout.enabled = false;
+        updateTextInfoExtent(textInfo);
+        markLayoutDirty();
+        break;
+    case AnimatedProperty::Value:
+    {
+        // whole units of 10^-decimals, so a counter never shows digits it wasn't asked for
+        char text[64];
+        snprintf(text, sizeof(text), "%.*f", animation.decimals, round(values[0]) / pow(10.0, animation.decimals));
+        if (textInfo.text == text)
+        {
+            return;
+        }
+        textInfo.text = text;
+        textInfo.wideText = to_wstring(textInfo.text);
+        measureTextInfo(textInfo);
+        markLayoutDirty();
+        break;
+    }
+    }
+    contentDirty = true;
 }
 
-void Response::addField(std::string field)
+void ControlPipe::relayoutTextInfos()
 {
-    fields.push_back(field);
-    status = "OK";
+    markLayoutDirty();
+    if (!layoutDirty)
+    {
+        return;
+    }
+
+    // not waiting for the client's next PAINT: it didn't change anything
+    auto dirtyRect = collectDirtyRect(false);
+    UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+    publishChanges();
 }
 
-void Response::setStatus(std::string status)
+void ControlPipe::markLayoutDirty()
 {
-    this->status = status;
+    if (layoutsInUse)
+    {
+        layoutDirty = true;
+    }
 }
 
-void Response::setOk()
+void ControlPipe::resolveLayouts()
 {
-    status = "OK";
+    if (!layoutDirty)
+    {
+        return;
+    }
+    layoutDirty = false;
+
+    RECT clientRectangle = { 0 };
+    GetClientRect(deskband->m_hwnd, &clientRectangle);
+    SIZE bandSize = { clientRectangle.right - clientRectangle.left, clientRectangle.bottom - clientRectangle.top };
+
+    // Places are kept in rect until something changes, so this runs once per change rather than once per paint
+    size_t enabled = 0;
+    for (size_t pass = 0; pass < LAYOUT_MAX_PASSES; pass++)
+    {
+        bool moved = false;
+        enabled = 0;
+        textInfoStore.forEach([&](TextInfo& textInfo)
+        {
+            if (!textInfo.layout.enabled)
+            {
+                return;
+            }
+            enabled++;
+
+            auto previous = textInfo.layout.after ? textInfoStore.find(textInfo.layout.after) : NULL;
+            auto topLeft = resolveLayout(textInfo.layout, textInfo.textSize, bandSize, previous ? &previous->rect : NULL);
+            if (topLeft.x != textInfo.rect.left || topLeft.y != textInfo.rect.top)
+            {
+                textInfo.rect.left = topLeft.x;
+                textInfo.rect.top = topLeft.y;
+                updateTextInfoExtent(textInfo);
+                moved = true;
+            }
+        });
+
+        if (!moved)
+        {
+            break;
+        }
+        contentDirty = true;
+    }
+
+    layoutsInUse = enabled > 0;
 }
 
-std::string Response::toString()
+void ControlPipe::pollSharedState()
 {
-    std::string ret = status + TRANSPORT_DELIM;
-    for (auto& field : fields)
+    // UI thread, every repaint tick
+    RECT dirtyRect = { 0 };
+    if (!sharedStateEnabled)
+    {
+        // turned off: whatever the slots showed goes away
+        for (auto& textInfo : sharedTextInfos)
+        {
+            RECT previous = glowRect(textInfo.rect);
+            UnionRect(&dirtyRect, &dirtyRect, &previous);
+        }
+        sharedTextInfos.clear();
+        sharedSequences.clear();
+        invalidate(dirtyRect);
+        return;
+    }
+
+    if (sharedTextInfos.size() != SHARED_STATE_SLOTS)
     {
-        ret += field + TRANSPORT_DELIM;
+        sharedTextInfos.resize(SHARED_STATE_SLOTS);
+        sharedSequences.assign(SHARED_STATE_SLOTS, 0);
     }
 
-    return ret + "\n";
+    SharedSlotValue value;
+    for (size_t i = 0; i < SHARED_STATE_SLOTS; i++)
+    {
+        if (!sharedState.readSlot(i, sharedSequences[i], value))
+        {
+            continue;
+        }
+
+        auto& textInfo = sharedTextInfos[i];
+        RECT previous = glowRect(textInfo.rect);
+        UnionRect(&dirtyRect, &dirtyRect, &previous);
+
+        if (value.flags & SHARED_SLOT_VISIBLE)
+        {
+            textInfo.red = value.red;
+            textInfo.green = value.green;
+            textInfo.blue = value.blue;
+            textInfo.rect.left = value.x;
+            textInfo.rect.top = value.y;
+
+            std::string_view text(value.text, value.textLength);
+            if (textInfo.text != text)
+            {
+                textInfo.text = std::string(text);
+                textInfo.wideText = to_wstring(textInfo.text);
+                textInfo.textSize = getTextSize(textInfo.wideText);
+            }
+            updateTextInfoExtent(textInfo);
+        }
+        else
+        {
+            // an empty rect is never drawn
+            textInfo = TextInfo();
+        }
+
+        RECT current = glowRect(textInfo.rect);
+        UnionRect(&dirtyRect, &dirtyRect, &current);
+    }
+
+    invalidate(dirtyRect);
+}
+
+void ControlPipe::publishChanges()
+{
+    resolveLayouts();
+
+    // Publish before invalidating, so the paint that follows sees the new state
+    if (textInfoStore.publish())
+    {
+        stateChanged = true;
+        updateBandExtent();
+    }
+    graphStore.publish();
+    invalidate(pendingInvalidation);
+    SetRectEmpty(&pendingInvalidation);
+}
+
+void ControlPipe::updateBandExtent()
+{
+    // read only: a publish must not leave the store marked as changed again
+    LONG contentWidth = 0;
+    std::as_const(textInfoStore).forEach([&](const TextInfo& textInfo)
+    {
+        if (textInfo.wideText.empty())
+        {
+            return;
+        }
+
+        // The glow is painted past the text's rect, so it counts too, or the band would clip the rightmost one.
+        // A layout anchored by percentage moves with the band, so only its own width counts (its right edge would
+        // follow any change of width we asked for).
+        LONG right = glowRect(textInfo.rect).right;
+        if (textInfo.layout.enabled && textInfo.layout.xPercent != 0)
+        {
+            right = textInfo.textSize.cx + 2 * TEXT_GLOW_SIZE + abs(textInfo.layout.xOffset);
+        }
+        contentWidth = right > contentWidth ? right : contentWidth;
+    });
+
+    // Before the window exists there's no one to tell, and GetBandInfo picks the width up once it does
+    if (bandExtent.update(contentWidth, GetDpiForWindow(deskband->m_hwnd)) && deskband->m_hwnd)
+    {
+        // GetBandInfo runs on the UI thread, so that's where the taskbar is told
+        PostMessage(deskband->m_hwnd, WM_BAND_EXTENT_CHANGED, 0, 0);
+    }
+}
+
+LONG ControlPipe::getBandExtent() const
+{
+    return bandExtent.getWidth();
+}
+
+BandState ControlPipe::saveState()
+{
+    BandState state;
+    state.maxFps = deskband->m_repaintScheduler.getMaxFps();
+    state.renderer = requestedBackend == RenderBackend::Direct2D ? 1 : 0;
+    state.textRunCacheEntries = (uint32_t)textRunCache.getMaxEntries();
+
+    auto textInfos = textInfoStore.snapshot();
+    std::unordered_map<TextInfoHandle, size_t> indices;
+    for (size_t i = 0; i < textInfos->size(); i++)
+    {
+        indices[(*textInfos)[i].handle] = i;
+    }
+
+    for (auto& textInfo : *textInfos)
+    {
+        TextInfo saved;
+        saved.text = textInfo.text;
+        saved.rect = textInfo.rect;
+        saved.red = textInfo.red;
+        saved.green = textInfo.green;
+        saved.blue = textInfo.blue;
+        saved.layout = textInfo.layout;
+
+        auto followed = indices.find(textInfo.layout.after);
+        saved.layout.after = followed != indices.end() ? (SlotHandle)(followed->second + 1) : 0;
+        state.textInfos.push_back(std::move(saved));
+    }
+
+    for (auto& entry : actions.getActions())
+    {
+        state.actions.push_back({ entry.first, to_utf8(entry.second->command), entry.second->debounceMs });
+    }
+    return state;
+}
+
+void ControlPipe::restoreState(BandState state)
+{
+    {
+        std::lock_guard<std::mutex> lock(restoreMutex);
+        pendingRestore = std::move(state);
+    }
+    restorePending = true;
+    SetEvent(hWakeEvent);
+}
+
+bool ControlPipe::takeStateChanged()
+{
+    return stateChanged.exchange(false);
+}
+
+void ControlPipe::applyRestoredState()
+{
+    std::optional<BandState> state;
+    {
+        std::lock_guard<std::mutex> lock(restoreMutex);
+        state.swap(pendingRestore);
+    }
+    if (!state)
+    {
+        return;
+    }
+
+    deskband->m_repaintScheduler.setMaxFps(state->maxFps);
+    requestedBackend = state->renderer ? RenderBackend::Direct2D : RenderBackend::Gdi;
+    textRunCache.setMaxEntries(state->textRunCacheEntries);
+    for (auto& action : state->actions)
+    {
+        actions.setAction(action.msg, action.command, action.debounceMs);
+    }
+
+    // replaces whatever a client set up before it arrived, like CLEAR
+    auto dirtyRect = collectDirtyRect(true);
+    UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+    textInfoStore.clear();
+
+    std::vector<TextInfoHandle> handles;
+    for (auto& saved : state->textInfos)
+    {
+        auto handle = createTextInfo();
+        if (!handle)
+        {
+            break;
+        }
+        handles.push_back(*handle);
+
+        auto textInfo = textInfoStore.edit(*handle);
+        textInfo->text = saved.text;
+        textInfo->wideText = to_wstring(saved.text);
+        textInfo->red = saved.red;
+        textInfo->green = saved.green;
+        textInfo->blue = saved.blue;
+        textInfo->rect.left = saved.rect.left;
+        textInfo->rect.top = saved.rect.top;
+        textInfo->layout = saved.layout;
+        measureTextInfo(*textInfo);
+    }
+
+    // saved layouts follow by index, restored ones by handle
+    layoutsInUse = false;
+    for (auto handle : handles)
+    {
+        auto& layout = textInfoStore.edit(handle)->layout;
+        layout.after = layout.after && layout.after <= handles.size() ? handles[layout.after - 1] : 0;
+        layoutsInUse = layoutsInUse || layout.enabled;
+    }
+    layoutDirty = layoutsInUse;
+
+    dirtyRect = collectDirtyRect(false);
+    UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+    publishChanges();
+
+    // this is what's saved already
+    stateChanged = false;
+    log("Restored " + std::to_string(handles.size()) + " TextInfos and " + std::to_string(state->actions.size()) + " actions");
+}
+
+std::optional<TextInfoHandle> ControlPipe::createTextInfo()
+{
+    auto handle = textInfoStore.create();
+    if (handle)
+    {
+        textInfoStore.edit(*handle)->handle = *handle;
+    }
+    return handle;
+}
+
+void ControlPipe::stopAsyncResponseThread()
+{
+    // The loop waits on this along with every client's I/O, so it wakes up right away (even if no one is connected).
+    SetEvent(hStopEvent);
+    this->asyncResponseThread.join();
+}
+
+void ControlPipe::asyncHandlingLoop()
+{
+    log("Starting loop");
+
+    HANDLE events[PIPE_MAX_CLIENTS + 2];
+    DWORD eventCount = 0;
+    events[eventCount++] = hStopEvent;
+    events[eventCount++] = hWakeEvent;
+    for (auto& client : clients)
+    {
+        events[eventCount++] = client->overlapped.hEvent;
+        connectClient(*client);
+    }
+
+    size_t firstClient = 0;
+    while (!shouldStop && clients.size())
+    {
+        auto ret = WaitForMultipleObjects(eventCount, events, FALSE, INFINITE);
+        if (ret == WAIT_OBJECT_0 || ret == WAIT_FAILED)
+        {
+            log("Detected stop condition");
+            break;
+        }
+
+        if (fontChanged.exchange(false))
+        {
+            remeasureTextInfos();
+        }
+        if (bandResized.exchange(false))
+        {
+            relayoutTextInfos();
+        }
+        if (animationFrameDue.exchange(false))
+        {
+            stepAnimations();
+        }
+        if (restorePending.exchange(false))
+        {
+            applyRestoredState();
+        }
+        deliverEvents();
+
+        // WaitForMultipleObjects always reports the lowest signaled index. Service every ready client instead,
+        // rotating who goes first, so one busy client can't starve the others.
+        for (size_t i = 0; i < clients.size() && !shouldStop; i++)
+        {
+            auto& client = *clients[(firstClient + i) % clients.size()];
+            if (WaitForSingleObject(client.overlapped.hEvent, 0) == WAIT_OBJECT_0)
+            {
+                serviceClient(client);
+            }
+        }
+        firstClient = (firstClient + 1) % clients.size();
+    }
+
+    for (auto& client : clients)
+    {
+        closeClient(*client);
+    }
+    clients.clear();
+
+    log("Exited loop");
+}
+
+void ControlPipe::serviceClient(PipeClient& client)
+{
+    DWORD bytes = 0;
+    BOOL success = TRUE;
+    bool moreData = false;
+    if (client.ioPending)
+    {
+        success = GetOverlappedResult(client.hPipe, &client.overlapped, &bytes, FALSE);
+        if (!success && GetLastError() == ERROR_MORE_DATA)
+        {
+            // the message didn't fit: bytes of it were read, the rest follows
+            success = TRUE;
+            moreData = true;
+        }
+        client.ioPending = false;
+    }
+
+    if (!success)
+    {
+        // client went away (or never fully connected)
+        reconnectClient(client);
+        return;
+    }
+
+    switch (client.state)
+    {
+    case PipeClient::State::Connecting:
+        log("Client connected");
+        startRead(client);
+        break;
+    case PipeClient::State::Reading:
+    {
+        stats.pipeReadBytes += bytes;
+        client.received += bytes;
+        if (moreData)
+        {
+            readMore(client);
+            break;
+        }
+
+        auto size = client.received;
+        client.response.clear();
+        if (client.oversized)
+        {
+            log(LogLevel::Warning, "Request is larger than " + std::to_string(PIPE_MAX_MESSAGE_SIZE) + " bytes, dropping it");
+            Response response;
+            if (client.transportVersion == TRANSPORT_VERSION_BINARY)
+            {
+                response.appendBinary(client.response);
+            }
+            else
+            {
+                response.appendText(client.response);
+            }
+            startWrite(client);
+            break;
+        }
+
+        if (client.transportVersion == TRANSPORT_VERSION_TEXT)
+        {
+            LOG(LogLevel::Verbose, "Request: " + std::string(client.buffer.data(), size));
+        }
+
+        {
+            PipeTraceActivity activity;
+            TraceLoggingWriteStart(activity, "HandleRequest",
+                TraceLoggingUInt32((UINT32)size, "Bytes"),
+                TraceLoggingInt32(client.transportVersion, "TransportVersion"));
+            handleRequest(client, client.buffer.data(), size);
+            TraceLoggingWriteStop(activity, "HandleRequest", TraceLoggingUInt32((UINT32)client.response.size(), "ResponseBytes"));
+        }
+
+        if (client.transportVersion == TRANSPORT_VERSION_TEXT)
+        {
+            LOG(LogLevel::Verbose, "Response: " + client.response);
+        }
+
+        if (client.response.size())
+        {
+            startWrite(client);
+        }
+        else
+        {
+            startRead(client);
+        }
+        break;
+    }
+    case PipeClient::State::Writing:
+        stats.pipeWriteBytes += bytes;
+        if (client.subscription.mask)
+        {
+            sendEvents(client);
+        }
+        else
+        {
+            startRead(client);
+        }
+        break;
+    case PipeClient::State::Subscribed:
+        // only signaled when I/O completes, and a subscriber has none pending
+        break;
+    }
+}
+
+void ControlPipe::connectClient(PipeClient& client)
+{
+    client.state = PipeClient::State::Connecting;
+    client.transportVersion = TRANSPORT_VERSION_TEXT;
+    client.pendingEvents.clear();
+    if (client.subscription.mask)
+    {
+        client.subscription = Subscription();
+        updateSubscriptions();
+    }
+
+    // An overlapped ConnectNamedPipe always 'fails': either pending or the client beat us to it.
+    ConnectNamedPipe(client.hPipe, &client.overlapped);
+    switch (GetLastError())
+    {
+    case ERROR_IO_PENDING:
+        client.ioPending = true;
+        break;
+    case ERROR_PIPE_CONNECTED:
+        SetEvent(client.overlapped.hEvent);
+        break;
+    default:
+        log(LogLevel::Error, "ConnectNamedPipe failed: " + std::to_string(GetLastError()));
+        break;
+    }
+}
+
+void ControlPipe::reconnectClient(PipeClient& client)
+{
+    DisconnectNamedPipe(client.hPipe);
+    connectClient(client);
+}
+
+void ControlPipe::startRead(PipeClient& client)
+{
+    client.state = PipeClient::State::Reading;
+    client.received = 0;
+    client.oversized = false;
+    if (client.buffer.size() > PIPE_KEEP_BUFFER_SIZE)
+    {
+        // one huge message shouldn't hold on to its memory for good
+        client.buffer.resize(BUFFER_SIZE);
+        client.buffer.shrink_to_fit();
+    }
+    readMore(client);
+}
+
+void ControlPipe::readMore(PipeClient& client)
+{
+    if (client.received == client.buffer.size())
+    {
+        if (client.buffer.size() < PIPE_MAX_MESSAGE_SIZE)
+        {
+            client.buffer.resize(client.buffer.size() * 2);
+        }
+        else
+        {
+            // too big to handle. The rest is read over what we have, just to get to the next message.
+            client.oversized = true;
+            client.received = 0;
+        }
+    }
+
+    auto error = ReadFile(client.hPipe, client.buffer.data() + client.received, (DWORD)(client.buffer.size() - client.received), NULL, &client.overlapped)
+        ? ERROR_SUCCESS : GetLastError();
+    if (error == ERROR_SUCCESS || error == ERROR_IO_PENDING || error == ERROR_MORE_DATA)
+    {
+        // the event is signaled either way
+        client.ioPending = true;
+    }
+    else
+    {
+        reconnectClient(client);
+    }
+}
+
+void ControlPipe::startWrite(PipeClient& client)
+{
+    client.state = PipeClient::State::Writing;
+    if (WriteFile(client.hPipe, client.response.data(), (DWORD)client.response.size(), NULL, &client.overlapped) || GetLastError() == ERROR_IO_PENDING)
+    {
+        client.ioPending = true;
+    }
+    else
+    {
+        reconnectClient(client);
+    }
+}
+
+void ControlPipe::closeClient(PipeClient& client)
+{
+    if (client.ioPending)
+    {
+        // The I/O must be finished before the buffers go away
+        DWORD bytes = 0;
+        CancelIo(client.hPipe);
+        GetOverlappedResult(client.hPipe, &client.overlapped, &bytes, TRUE);
+        client.ioPending = false;
+    }
+
+    DisconnectNamedPipe(client.hPipe);
+    CloseHandle(client.hPipe);
+    client.hPipe = INVALID_HANDLE_VALUE;
+    CloseHandle(client.overlapped.hEvent);
+    client.overlapped.hEvent = NULL;
+}
+
+void ControlPipe::sendEvents(PipeClient& client)
+{
+    if (client.pendingEvents.empty())
+    {
+        // Nothing to send until the next event. The loop waits on our event, so it must not stay signaled till then.
+        client.state = PipeClient::State::Subscribed;
+        ResetEvent(client.overlapped.hEvent);
+        return;
+    }
+
+    client.response.swap(client.pendingEvents);
+    client.pendingEvents.clear();
+    startWrite(client);
+}
+
+void ControlPipe::appendEvent(PipeClient& client, const BandEvent& event)
+{
+    if (client.pendingEvents.size() >= PIPE_MAX_PENDING_EVENTS)
+    {
+        log(LogLevel::Warning, "Subscriber is not reading its events, dropping event: " + std::to_string(event.type));
+        return;
+    }
+
+    Response response;
+    event.addTo(response);
+    if (client.transportVersion == TRANSPORT_VERSION_BINARY)
+    {
+        response.appendBinary(client.pendingEvents);
+    }
+    else
+    {
+        response.appendText(client.pendingEvents);
+    }
+}
+
+void ControlPipe::deliverEvents()
+{
+    eventQueue.take(takenEvents);
+    if (takenEvents.empty())
+    {
+        return;
+    }
+
+    for (auto& client : clients)
+    {
+        if (!client->subscription.mask)
+        {
+            continue;
+        }
+
+        for (auto& event : takenEvents)
+        {
+            if (client->subscription.wants(event))
+            {
+                appendEvent(*client, event);
+            }
+        }
+
+        // otherwise they go out once the write in progress is done
+        if (client->state == PipeClient::State::Subscribed)
+        {
+            sendEvents(*client);
+        }
+    }
+}
+
+void ControlPipe::queueCurrentState(PipeClient& client)
+{
+    // what the events would have said so far, so a subscriber needn't ask as well
+    auto hwnd = deskband->m_hwnd;
+    RECT clientRectangle = { 0 };
+    GetClientRect(hwnd, &clientRectangle);
+
+    BandEvent current[] = {
+        { EVENT_SIZE, { clientRectangle.right - clientRectangle.left, clientRectangle.bottom - clientRectangle.top } },
+        { EVENT_DPI, { (int32_t)GetDpiForWindow(hwnd), 0 } },
+        { EVENT_COMPOSITION, { deskband->m_fCompositionEnabled ? 1 : 0, 0 } },
+        { EVENT_VISIBILITY, { IsWindowVisible(hwnd) ? 1 : 0, 0 } },
+    };
+    for (auto& event : current)
+    {
+        if (client.subscription.wants(event))
+        {
+            appendEvent(client, event);
+        }
+    }
+}
+
+void ControlPipe::updateSubscriptions()
+{
+    std::vector<const Subscription*> subscriptions;
+    for (auto& client : clients)
+    {
+        if (client->subscription.mask)
+        {
+            subscriptions.push_back(&client->subscription);
+        }
+    }
+    eventQueue.update(subscriptions);
+}
+
+class TextInfoNullException : public std::exception
+{
+    using std::exception::exception;
+};
+
+template <typename T>
+T* verifyTextInfo(T* textInfo)
+{
+    if (!textInfo)
+    { 
+        throw TextInfoNullException("TextInfo was NULL");
+    }
+    return textInfo;
+}
+
+void ControlPipe::handleRequest(PipeClient& client, const char* data, size_t size)
+{
+    auto& out = client.response;
+
+    // The version in use when the request arrived is used for the reply, even if the request changes it.
+    auto version = client.transportVersion;
+    Response response;
+
+    if (version == TRANSPORT_VERSION_BINARY)
+    {
+        // Every frame in the write is a command of the batch
+        size_t offset = 0;
+        while (offset < size)
+        {
+            Request request;
+            auto consumed = parseBinaryRequest(data + offset, size - offset, request);
+            response.reset();
+            if (consumed == 0)
+            {
+                log(LogLevel::Warning, "Malformed binary request");
+                response.appendBinary(out);
+                break;
+            }
+
+            processRequest(client, request, response);
+            response.setId(request.id);
+            response.appendBinary(out);
+            offset += consumed;
+        }
+
+        // Published once for the whole request, so a batch is never seen half applied
+        publishChanges();
+        return;
+    }
+
+    std::string_view message(data, size);
+    // +1 for the header, and +1 more to tell a batch that's too long from one that just fits
+    std::string_view lines[BATCH_MAX_COMMANDS + 2];
+    auto lineCount = split(message, BATCH_DELIM, lines, BATCH_MAX_COMMANDS + 2);
+    size_t firstCommand = 0;
+    if (lines[0] == BATCH_HEADER)
+    {
+        // BATCH\n<command>\n<command>... gets back one response line per command, in a single write.
+        firstCommand = 1;
+        if (lineCount > BATCH_MAX_COMMANDS + 1)
+        {
+            // nothing of it is run, rather than some of it without saying which
+            log(LogLevel::Warning, "Batch of more than " + std::to_string(BATCH_MAX_COMMANDS) + " commands");
+            response.reset();
+            response.appendText(out);
+            return;
+        }
+    }
+    else
+    {
+        lineCount = 1;
+        lines[0] = message;
+    }
+
+    for (size_t i = firstCommand; i < lineCount; i++)
+    {
+        if (lines[i].empty())
+        {
+            continue;
+        }
+
+        Request request;
+        response.reset();
+        if (parseTextRequest(lines[i], request))
+        {
+            processRequest(client, request, response);
+        }
+        // even for a command we don't know, if the id could be read
+        response.setId(request.id);
+        response.appendText(out);
+    }
+
+    if (out.empty())
+    {
+        // an empty batch
+        response.reset();
+        response.setOk();
+        response.appendText(out);
+    }
+
+    publishChanges();
+}
+
+void ControlPipe::processRequest(PipeClient& client, const Request& request, Response& response)
+{
+    Stopwatch stopwatch;
+    PipeTraceActivity activity;
+    TraceLoggingWriteStart(activity, "ProcessRequest", TraceLoggingUInt16((UINT16)request.opcode, "Opcode"));
+
+    // Do not use __textInfo directly... it may be empty or stale. Use GET_TEXT_INFO (to read) or EDIT_TEXT_INFO (to
+    // change it), which will throw if so. A target named by the command itself wins over the current one.
+    auto __textInfo = request.target ? request.target : getTextInfoTarget(setsTextInfo(request.opcode));
+    #define GET_TEXT_INFO() verifyTextInfo(__textInfo ? textInfoStore.find(*__textInfo) : NULL)
+    #define EDIT_TEXT_INFO() verifyTextInfo(__textInfo ? textInfoStore.edit(*__textInfo) : NULL)
+
+    try
+    {
+        switch (request.opcode)
+        {
+        case Opcode::GetWidth:
+        {
+            RECT rc;
+            GetClientRect(deskband->m_hwnd, &rc);
+            response.addField((int64_t)(rc.right - rc.left));
+            break;
+        }
+        case Opcode::GetHeight:
+        {
+            RECT rc;
+            GetClientRect(deskband->m_hwnd, &rc);
+            response.addField((int64_t)(rc.bottom - rc.top));
+            break;
+        }
+        case Opcode::GetTextSize:
+        {
+            auto size = getTextSize(to_wstring(std::string(request.getText(0))));
+            response.addField((int64_t)size.cx);
+            response.addField((int64_t)size.cy);
+            break;
+        }
+        case Opcode::GetTextInfoCount:
+            response.addField((int64_t)textInfoStore.size());
+            break;
+        case Opcode::GetTextInfoTarget:
+            if (textInfoTarget)
+            {
+                response.addField((int64_t)*textInfoTarget);
+            }
+            else
+            {
+                response.addField("None");
+            }
+            break;
+        case Opcode::GetRgb:
+        {
+            auto textInfo = GET_TEXT_INFO();
+            response.addField((int64_t)textInfo->red);
+            response.addField((int64_t)textInfo->green);
+            response.addField((int64_t)textInfo->blue);
+            break;
+        }
+        case Opcode::GetText:
+        {
+            auto textInfo = GET_TEXT_INFO();
+            response.addField(textInfo->text);
+            break;
+        }
+        case Opcode::GetXY:
+        {
+            // where the layout puts it now, if it has one
+            resolveLayouts();
+            auto textInfo = GET_TEXT_INFO();
+            response.addField((int64_t)textInfo->rect.left);
+            response.addField((int64_t)textInfo->rect.top);
+            break;
+        }
+        case Opcode::GetTransportVersion:
+            // current, then the max we support
+            response.addField((int64_t)client.transportVersion);
+            response.addField((int64_t)TRANSPORT_VERSION_MAX);
+            break;
+        case Opcode::GetStats:
+        {
+            // name, value pairs. GET,STATS,1 also resets everything once it's been reported.
+            stats.addTo(response);
+            response.addField("textinfos");
+            response.addField((int64_t)textInfoStore.size());
+            response.addField("graphs");
+            response.addField((int64_t)graphStore.size());
+            response.addField("text_run_hits");
+            response.addField((int64_t)textRunCache.hits);
+            response.addField("text_run_misses");
+            response.addField((int64_t)textRunCache.misses);
+            if (request.size() > 0 && request.getInt(0))
+            {
+                stats.reset();
+                textRunCache.hits = 0;
+                textRunCache.misses = 0;
+            }
+            break;
+        }
+        case Opcode::GetInstance:
+        {
+            // which band this is: its instance id, its DPI and where it is on screen (so which taskbar)
+            RECT windowRect = { 0 };
+            GetWindowRect(deskband->m_hwnd, &windowRect);
+            response.addField((int64_t)instanceId);
+            response.addField((int64_t)GetDpiForWindow(deskband->m_hwnd));
+            response.addField((int64_t)windowRect.left);
+            response.addField((int64_t)windowRect.top);
+            response.addField((int64_t)windowRect.right);
+            response.addField((int64_t)windowRect.bottom);
+            break;
+        }
+        case Opcode::GetAll:
+        {
+            // GET,ALL[,<generation>[,<cursor>]] replies <generation>,<next cursor>,<count>, then handle, x, y, r, g, b
+            // and text for each of up to GET_ALL_MAX_TEXTINFOS TextInfos. A next cursor of 0 means that was the last
+            // of them; otherwise ask again with it (if the generation changed on the way, start over). If generation
+            // is the current one, nothing changed since it was read: the reply has no TextInfos.
+            resolveLayouts();
+            auto generation = (int64_t)textInfoStore.workingGeneration();
+            auto known = request.size() > 0 ? std::optional<int64_t>(request.getInt(0)) : std::nullopt;
+            auto cursor = request.size() > 1 ? (size_t)request.getInt(1) : 0;
+            response.addField(generation);
+            if (known == generation && cursor == 0)
+            {
+                response.addField((int64_t)0);
+                response.addField((int64_t)0);
+                break;
+            }
+
+            // the cursor is a slot index, so TextInfos created or deleted meanwhile never shift the rest
+            TextInfoHandle handles[GET_ALL_MAX_TEXTINFOS];
+            size_t count = 0;
+            size_t index = cursor;
+            for (; index < textInfoStore.slotCount() && count < GET_ALL_MAX_TEXTINFOS; index++)
+            {
+                auto handle = textInfoStore.handleAt(index);
+                if (handle)
+                {
+                    handles[count++] = *handle;
+                }
+            }
+            response.addField((int64_t)(index < textInfoStore.slotCount() ? index : 0));
+            response.addField((int64_t)count);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto textInfo = textInfoStore.find(handles[i]);
+                response.addField((int64_t)handles[i]);
+                response.addField((int64_t)textInfo->rect.left);
+                response.addField((int64_t)textInfo->rect.top);
+                response.addField((int64_t)textInfo->red);
+                response.addField((int64_t)textInfo->green);
+                response.addField((int64_t)textInfo->blue);
+                response.addField(textInfo->text);
+            }
+            break;
+        }
+        // The setters only touch (and dirty) the TextInfo if the value is different, then reply 1 if it was or 0 if the
+        // SET was a no-op. Clients that resend their whole state every tick then cost nothing to paint.
+        case Opcode::SetRgb:
+        {
+            auto red = (unsigned)request.getInt(0);
+            auto green = (unsigned)request.getInt(1);
+            auto blue = (unsigned)request.getInt(2);
+            auto textInfo = GET_TEXT_INFO();
+            // setting it outright stops any animation of it, here and in the SET,TEXT and SET,XY cases
+            animator.cancel(*__textInfo, AnimatedProperty::Rgb);
+            bool changed = textInfo->red != red || textInfo->green != green || textInfo->blue != blue;
+            if (changed)
+            {
+                auto edited = EDIT_TEXT_INFO();
+                edited->red = red;
+                edited->green = green;
+                edited->blue = blue;
+                edited->dirty = true;
+                contentDirty = true;
+            }
+            response.addField((int64_t)changed);
+            break;
+        }
+        case Opcode::SetText:
+        {
+            auto text = request.getText(0);
+            auto textInfo = GET_TEXT_INFO();
+            animator.cancel(*__textInfo, AnimatedProperty::Value);
+            bool changed = textInfo->text != text;
+            if (changed)
+            {
+                auto edited = EDIT_TEXT_INFO();
+                edited->text = std::string(text);
+                edited->wideText = to_wstring(edited->text);
+                measureTextInfo(*edited);
+                markLayoutDirty();
+                contentDirty = true;
+            }
+            response.addField((int64_t)changed);
+            break;
+        }
+        case Opcode::SetXY:
+        {
+            // xy from top left. Placing it explicitly ends its layout, if it had one.
+            auto x = (LONG)request.getInt(0);
+            auto y = (LONG)request.getInt(1);
+            auto textInfo = GET_TEXT_INFO();
+            animator.cancel(*__textInfo, AnimatedProperty::XY);
+            bool changed = textInfo->rect.left != x || textInfo->rect.top != y || textInfo->layout.enabled;
+            if (changed)
+            {
+                auto edited = EDIT_TEXT_INFO();
+                edited->rect.left = x;
+                edited->rect.top = y;
+                edited->layout.enabled = false;
+                updateTextInfoExtent(*edited);
+                markLayoutDirty();
+                contentDirty = true;
+            }
+            response.addField((int64_t)changed);
+            break;
+        }
+        case Opcode::SetAnimation:
+        {
+            // SET,ANIMATION,<property>,<duration ms>,<easing>,<values...> moves the TextInfo from where it is to the
+            // values over the duration (see Animation.h). The values are r,g,b for RGB (0), x,y for XY (1) and
+            // value[,decimals] for VALUE (2), where the text counts from the number it shows to value/10^decimals.
+            // Without fields, its animations stop where they are.
+            auto textInfo = GET_TEXT_INFO();
+            if (request.size() == 0)
+            {
+                animator.cancel(*__textInfo);
+                response.setOk();
+                break;
+            }
+
+            Animation animation;
+            animation.target = *__textInfo;
+            auto property = request.getInt(0);
+            auto duration = request.getInt(1);
+            auto easing = request.getInt(2);
+            if (property < (int64_t)AnimatedProperty::Rgb || property > (int64_t)AnimatedProperty::Value
+                || easing < (int64_t)Easing::Linear || easing > (int64_t)Easing::EaseInOut || duration < 0)
+            {
+                break;
+            }
+            animation.property = (AnimatedProperty)property;
+            animation.decimals = animation.property == AnimatedProperty::Value && request.size() > 4 ? (int)request.getInt(4) : 0;
+            if (animation.decimals < 0 || animation.decimals > 9)
+            {
+                break;
+            }
+            animation.easing = (Easing)easing;
+            animation.startMs = GetTickCount64();
+            animation.durationMs = (ULONGLONG)duration;
+
+            switch (animation.property)
+            {
+            case AnimatedProperty::Rgb:
+                animation.from[0] = textInfo->red;
+                animation.from[1] = textInfo->green;
+                animation.from[2] = textInfo->blue;
+                animation.to[0] = (double)request.getInt(3);
+                animation.to[1] = (double)request.getInt(4);
+                animation.to[2] = (double)request.getInt(5);
+                break;
+            case AnimatedProperty::XY:
+                animation.from[0] = textInfo->rect.left;
+                animation.from[1] = textInfo->rect.top;
+                animation.to[0] = (double)request.getInt(3);
+                animation.to[1] = (double)request.getInt(4);
+                break;
+            case AnimatedProperty::Value:
+            {
+                animation.to[0] = (double)request.getInt(3);
+                // text that isn't a number starts at the target
+                char* end = NULL;
+                auto shown = strtod(textInfo->text.c_str(), &end);
+                animation.from[0] = end != textInfo->text.c_str() ? round(shown * pow(10.0, animation.decimals)) : animation.to[0];
+                break;
+            }
+            }
+
+            if (!animator.start(animation))
+            {
+                break;
+            }
+            if (!animating.exchange(true))
+            {
+                deskband->m_repaintScheduler.setPolling(REPAINT_POLL_ANIMATION, true);
+            }
+            response.setOk();
+            break;
+        }
+        case Opcode::SetLayout:
+        {
+            // SET,LAYOUT,<x%>,<y%>,<x offset>,<y offset>,<horizontal align>,<vertical align>[,<after>,<flow>,<gap>]
+            // places the TextInfo from now on (see Layout.h). Without fields, it stays where it is, as if by SET,XY.
+            if (request.size() == 0)
+            {
+                EDIT_TEXT_INFO()->layout.enabled = false;
+                response.setOk();
+                break;
+            }
+
+            Layout layout;
+            layout.enabled = true;
+            layout.xPercent = (int)request.getInt(0);
+            layout.yPercent = (int)request.getInt(1);
+            layout.xOffset = (LONG)request.getInt(2);
+            layout.yOffset = (LONG)request.getInt(3);
+            auto horizontal = request.getInt(4);
+            auto vertical = request.getInt(5);
+            if (request.size() > 6)
+            {
+                layout.after = (SlotHandle)request.getInt(6);
+                auto flow = request.getInt(7);
+                if (flow != (int64_t)LayoutFlow::Right && flow != (int64_t)LayoutFlow::Below)
+                {
+                    break;
+                }
+                layout.flow = (LayoutFlow)flow;
+                layout.gap = (LONG)request.getInt(8);
+            }
+            if (horizontal < 0 || horizontal > (int64_t)LayoutAlign::End || vertical < 0 || vertical > (int64_t)LayoutAlign::End)
+            {
+                break;
+            }
+            layout.horizontal = (LayoutAlign)horizontal;
+            layout.vertical = (LayoutAlign)vertical;
+
+            EDIT_TEXT_INFO()->layout = layout;
+            layoutsInUse = true;
+            layoutDirty = true;
+            contentDirty = true;
+            response.setOk();
+            break;
+        }
+        case Opcode::SetWinMsg:
+        {
+            // set a (not already handled) Windows Message control to call something,
+            // optionally ignoring repeats within the given number of milliseconds
+            auto msg = (DWORD)request.getInt(0);
+            if (request.size() < 2)
+            {
+                if (actions.removeAction(msg))
+                {
+                    stateChanged = true;
+                    response.setOk();
+                }
+                else
+                {
+                    response.setStatus(Status::MsgNotFound);
+                }
+            }
+            else
+            {
+                auto debounceMs = request.size() > 2 ? request.getInt(2) : 0;
+                if (debounceMs >= 0)
+                {
+                    actions.setAction(msg, std::string(request.getText(1)), (ULONGLONG)debounceMs);
+                    stateChanged = true;
+                    response.setOk();
+                }
+            }
+            break;
+        }
+        case Opcode::SetTextInfoTarget:
+            if (request.size() == 1)
+            {
+                textInfoTarget = (size_t)request.getInt(0);
+                log("Set textInfoTarget to: " + std::to_string(*textInfoTarget));
+            }
+            else
+            {
+                textInfoTarget.reset();
+                log("Set textInfoTarget to: <reset>");
+            }
+            response.setOk();
+            break;
+        case Opcode::SetLoggingEnabled:
+            setLoggingEnabled((bool)request.getInt(0));
+            response.setOk();
+            break;
+        case Opcode::SetLogLevel:
+        {
+            auto level = request.getInt(0);
+            if (level >= (int)LogLevel::Error && level <= (int)LogLevel::Verbose)
+            {
+                setLogLevel((LogLevel)level);
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::SetTransportVersion:
+        {
+            auto version = request.getInt(0);
+            if (version >= TRANSPORT_VERSION_TEXT && version <= TRANSPORT_VERSION_MAX)
+            {
+                client.transportVersion = (int)version;
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::SetMaxFps:
+        {
+            // 0 means unlimited
+            auto fps = request.getInt(0);
+            if (fps >= 0)
+            {
+                deskband->m_repaintScheduler.setMaxFps((unsigned)fps);
+                stateChanged = true;
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::SetTextRunCache:
+        {
+            // how many drawn text runs to keep. 0 draws all text from scratch on every paint.
+            auto entries = request.getInt(0);
+            if (entries >= 0)
+            {
+                textRunCache.setMaxEntries((size_t)entries);
+                stateChanged = true;
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::SetGraph:
+        {
+            // SET,GRAPH,<handle>,<x>,<y>,<width>,<height>,<r>,<g>,<b>,<min>,<max>[,<style>]
+            auto handle = (GraphHandle)request.getInt(0);
+            RECT rect;
+            rect.left = (LONG)request.getInt(1);
+            rect.top = (LONG)request.getInt(2);
+            rect.right = rect.left + (LONG)request.getInt(3);
+            rect.bottom = rect.top + (LONG)request.getInt(4);
+            auto red = (unsigned)request.getInt(5);
+            auto green = (unsigned)request.getInt(6);
+            auto blue = (unsigned)request.getInt(7);
+            auto minimum = (int32_t)request.getInt(8);
+            auto maximum = (int32_t)request.getInt(9);
+            auto style = request.size() > 10 ? request.getInt(10) : (int64_t)GraphStyle::Line;
+            if (style != (int64_t)GraphStyle::Line && style != (int64_t)GraphStyle::Bars)
+            {
+                break;
+            }
+
+            auto graph = graphStore.edit(handle);
+            if (!graph)
+            {
+                response.setStatus(Status::GraphNotFound);
+                break;
+            }
+            graph->rect = rect;
+            graph->red = red;
+            graph->green = green;
+            graph->blue = blue;
+            graph->minimum = minimum;
+            graph->maximum = maximum;
+            graph->style = (GraphStyle)style;
+            graph->dirty = true;
+            contentDirty = true;
+            response.setOk();
+            break;
+        }
+        case Opcode::SetRenderer:
+        {
+            // 0 for GDI, 1 for Direct2D. Direct2D falls back to GDI if it isn't available, and both fall back to plain
+            // GDI while composition is off. The next paint switches over.
+            auto renderer = request.getInt(0);
+            if (renderer == 0 || renderer == 1)
+            {
+                requestedBackend = renderer ? RenderBackend::Direct2D : RenderBackend::Gdi;
+                stateChanged = true;
+                RECT clientRectangle;
+                GetClientRect(deskband->m_hwnd, &clientRectangle);
+                UnionRect(&pendingInvalidation, &pendingInvalidation, &clientRectangle);
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::SetSharedState:
+        {
+            // the UI thread only looks at sharedState once it's enabled, so it's opened first
+            auto enabled = (bool)request.getInt(0);
+            if (!enabled || sharedState.open(instanceName(SHARED_STATE_NAME, instanceId)))
+            {
+                sharedStateEnabled = enabled;
+                deskband->m_repaintScheduler.setPolling(REPAINT_POLL_SHARED_STATE, enabled);
+                response.setOk();
+            }
+            break;
+        }
+        case Opcode::NewTextInfo:
+        {
+            // replies with the new TextInfo's handle
+            auto handle = createTextInfo();
+            if (handle)
+            {
+                response.addField((int64_t)*handle);
+            }
+            break;
+        }
+        case Opcode::DeleteTextInfo:
+        {
+            // DELETE_TEXTINFO,<handle> (or the inline target). Other TextInfos keep their handles and positions.
+            auto handle = request.size() > 0 ? std::optional<TextInfoHandle>((TextInfoHandle)request.getInt(0)) : __textInfo;
+            auto textInfo = verifyTextInfo(handle ? textInfoStore.find(*handle) : NULL);
+
+            RECT previous = glowRect(textInfo->paintedRect);
+            RECT current = glowRect(textInfo->rect);
+            UnionRect(&pendingInvalidation, &pendingInvalidation, &previous);
+            UnionRect(&pendingInvalidation, &pendingInvalidation, &current);
+            textInfoStore.remove(*handle);
+            // anything that followed it is anchored to the band now
+            markLayoutDirty();
+            response.setOk();
+            break;
+        }
+        case Opcode::NewGraph:
+        {
+            // NEW_GRAPH,<capacity> replies with the new graph's handle. Graphs have handles of their own, apart
+            // from TextInfos'.
+            auto capacity = request.getInt(0);
+            if (capacity > 0 && capacity <= GRAPH_MAX_CAPACITY)
+            {
+                auto handle = graphStore.create();
+                if (handle)
+                {
+                    graphStore.edit(*handle)->setCapacity((size_t)capacity);
+                    response.addField((int64_t)*handle);
+                }
+            }
+            break;
+        }
+        case Opcode::Subscribe:
+        {
+            // SUBSCRIBE,<mask>[,<msg>...]: once the reply is sent, the connection only gets events
+            Subscription subscription;
+            subscription.mask = (uint32_t)request.getInt(0) & EVENT_ALL;
+            for (size_t i = 1; i < request.size(); i++)
+            {
+                subscription.messages.push_back((DWORD)request.getInt(i));
+            }
+
+            client.subscription = std::move(subscription);
+            client.pendingEvents.clear();
+            updateSubscriptions();
+            queueCurrentState(client);
+            response.setOk();
+            break;
+        }
+        case Opcode::DeleteGraph:
+        {
+            auto handle = (GraphHandle)request.getInt(0);
+            auto graph = graphStore.find(handle);
+            if (!graph)
+            {
+                response.setStatus(Status::GraphNotFound);
+                break;
+            }
+
+            UnionRect(&pendingInvalidation, &pendingInvalidation, &graph->paintedRect);
+            UnionRect(&pendingInvalidation, &pendingInvalidation, &graph->rect);
+            graphStore.remove(handle);
+            response.setOk();
+            break;
+        }
+        case Opcode::AppendGraph:
+        {
+            // GRAPH_APPEND,<handle>,<samples>... where each field is a sample or a space separated list of them
+            auto graph = graphStore.edit((GraphHandle)request.getInt(0));
+            if (!graph)
+            {
+                response.setStatus(Status::GraphNotFound);
+                break;
+            }
+
+            for (size_t i = 1; i < request.size(); i++)
+            {
+                if (!request.isText(i))
+                {
+                    graph->append((int32_t)request.getInt(i));
+                }
+                else if (!graph->appendAll(request.getText(i)))
+                {
+                    throw BadRequestException("Bad sample");
+                }
+            }
+            contentDirty = true;
+            response.setOk();
+            break;
+        }
+        case Opcode::Paint:
+        {
+            // nothing changed since the last PAINT: nothing to look at, publish or repaint
+            if (contentDirty)
+            {
+                auto dirtyRect = collectDirtyRect(false);
+                UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+            }
+            response.setOk();
+            break;
+        }
+        case Opcode::Clear:
+        {
+            // everything that was (or was about to be) on screen goes away
+            auto dirtyRect = collectDirtyRect(true);
+            textInfoStore.clear();
+            graphStore.clear();
+            UnionRect(&pendingInvalidation, &pendingInvalidation, &dirtyRect);
+            response.setOk();
+            break;
+        }
+        case Opcode::Stop:
+            // the loop notices this once the current request is done
+            shouldStop = true;
+            response.setOk();
+            break;
+        case Opcode::SendWindowMessage:
+            // Posted rather than sent, so a slow window procedure can't hold up the pipe.
+            PostMessage(deskband->m_hwnd, (UINT)request.getInt(0), 0, 0);
+            response.setOk();
+            break;
+        default:
+            break;
+        }
+    }
+    catch (TextInfoNullException)
+    {
+        response.setStatus(Status::TextInfoTargetInvalid);
+    }
+    catch (BadRequestException)
+    {
+        response.reset();
+    }
+    catch (const std::exception& ex)
+    {
+        // Anything escaping would end the pipe thread, and explorer with it. The request just fails instead.
+        log(LogLevel::Error, std::string("Request failed: ") + ex.what());
+        response.reset();
+    }
+
+    TraceLoggingWriteStop(activity, "ProcessRequest", TraceLoggingUInt16((UINT16)request.opcode, "Opcode"));
+    stats.recordRequest(request.opcode, stopwatch.elapsedUs());
+}
+
+SIZE ControlPipe::getTextSize(const std::wstring& text)
+{
+    // Text is drawn into memory DCs (the back buffer and text runs), with the font they start out with. One of its
+    // own gets the same font, and can be used from either thread.
+    HDC dc = CreateCompatibleDC(NULL);
+    SIZE sz = { 0 };
+    GetTextExtentPoint32W(dc, text.c_str(), (int)text.size(), &sz);
+    DeleteDC(dc);
+    return sz;
+}
+
+void ControlPipe::measureTextInfo(TextInfo& textInfo)
+{
+    textInfo.textSize = getTextSize(textInfo.wideText);
+    updateTextInfoExtent(textInfo);
+}
+
+void ControlPipe::updateTextInfoExtent(TextInfo& textInfo)
+{
+    textInfo.rect.right = textInfo.rect.left + textInfo.textSize.cx;
+    textInfo.rect.bottom = textInfo.rect.top + textInfo.textSize.cy;
+    textInfo.dirty = true;
+}
+
+RECT ControlPipe::collectDirtyRect(bool all)
+{
+    // The union of where changed TextInfos (and graphs) were last painted and where they will be painted next
+    resolveLayouts();
+    RECT dirtyRect = { 0 };
+    textInfoStore.forEach([&](TextInfo& textInfo)
+    {
+        if (textInfo.dirty || all)
+        {
+            RECT previous = glowRect(textInfo.paintedRect);
+            RECT current = glowRect(textInfo.rect);
+            UnionRect(&dirtyRect, &dirtyRect, &previous);
+            UnionRect(&dirtyRect, &dirtyRect, &current);
+
+            textInfo.paintedRect = textInfo.rect;
+            textInfo.dirty = false;
+        }
+    });
+    graphStore.forEach([&](Graph& graph)
+    {
+        if (graph.dirty || all)
+        {
+            UnionRect(&dirtyRect, &dirtyRect, &graph.paintedRect);
+            UnionRect(&dirtyRect, &dirtyRect, &graph.rect);
+
+            graph.paintedRect = graph.rect;
+            graph.dirty = false;
+        }
+    });
+    contentDirty = false;
+    return dirtyRect;
+}
+
+std::optional<TextInfoHandle> ControlPipe::getTextInfoTarget(bool createIfEmpty)
+{
+    if (textInfoStore.size() == 0 && createIfEmpty)
+    {
+        createTextInfo();
+    }
+
+    // the last text info, unless textInfoTarget picks one by position
+    if (!textInfoTarget)
+    {
+        return textInfoStore.newest();
+    }
+
+    auto textInfo = textInfoStore.handleAt(*textInfoTarget);
+    if (!textInfo)
+    {
+        log(LogLevel::Warning, "Out of bounds text info target: " + std::to_string(*textInfoTarget));
+    }
+    return textInfo;
 }
@@ -1,44 +1,77 @@
 #pragma once
 
+#include "ActionDispatcher.h"
+#include "Animation.h"
+#include "BackBuffer.h"
+#include "BandExtent.h"
+#include "BandResources.h"
+#include "BandState.h"
+#include "D2DRenderer.h"
+#include "EventQueue.h"
+#include "Graph.h"
+#include "SharedState.h"
+#include "Stats.h"
+#include "TextInfoStore.h"
+#include "TextRunCache.h"
+
 #include <Windows.h>
+#include <uxtheme.h>
+#include <atomic>
 #include <thread>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 
+// The first band in explorer gets this name. Any on other taskbars get PIPE_NAME.<instance id> (see instanceName).
+#define PIPE_NAME TEXT("\\\\.\\pipe\\PyDeskbandControlPipe")
+#define PIPE_MAX_CLIENTS 8
+// Each client write is one pipe message, read whole into a buffer that starts at BUFFER_SIZE and doubles as needed.
+// Past PIPE_MAX_MESSAGE_SIZE a message is thrown away (and gets a BadCommand). A buffer grown past
+// PIPE_KEEP_BUFFER_SIZE shrinks back once its message is handled.
+#define BUFFER_SIZE (1024 * 8)
+#define PIPE_MAX_MESSAGE_SIZE (1024 * 1024 * 16)
+#define PIPE_KEEP_BUFFER_SIZE (1024 * 64)
+// Events wait here while a subscriber is slow to read them. Past this, new ones are dropped.
+#define PIPE_MAX_PENDING_EVENTS (1024 * 64)
+
 class CDeskBand;
+class Request;
+class Response;
 
-struct TextInfo
+// One instance of the named pipe. Each connected client gets its own, so several can be connected at once.
+struct PipeClient
 {
-	TextInfo()
-	{
-		memset(this, 0, sizeof(TextInfo));
-	}
-
-	unsigned red;
-	unsigned green;
-	unsigned blue;
-
-	std::string text;
-	RECT rect;
+	// Subscribed: waiting for an event to send, with no I/O pending
+	enum class State { Connecting, Reading, Writing, Subscribed };
 
-	std::string toString();
+	HANDLE hPipe;
+	OVERLAPPED overlapped;
+	State state;
+	bool ioPending;
+	int transportVersion;
+	std::vector<char> buffer;
+	// how much of the message being read is in buffer. oversized is set once it's more than we'll take.
+	size_t received;
+	bool oversized;
+	std::string response;
+
+	// Set by SUBSCRIBE. From then on the connection is only written to: a subscriber that went away is noticed when
+	// its next event is sent.
+	Subscription subscription;
+	std::string pendingEvents;
 };
 
-class Response
+enum class RenderBackend
 {
-public:
-	Response();
-
-	void addField(std::string field);
-	void setStatus(std::string status);
-	void setOk();
-
-	std::string toString();
-private:
-	std::string status;
-	std::vector<std::string> fields;
+	// composition is off: plain GDI text, drawn straight onto the window
+	Uncomposited,
+	// UxTheme text with a glow, into the back buffer
+	Gdi,
+	// Direct2D + DirectWrite, into the back buffer
+	Direct2D,
 };
 
 class ControlPipe
@@ -50,26 +83,149 @@ public:
 	DWORD msgHandler(DWORD msg);
 
 	void paintAllTextInfos();
+	void onFontChanged();
+	void onCompositionChanged();
+
+	// UI thread, for IPersistStream. saveState copies what's published, restoreState hands a loaded state to the pipe
+	// thread, which replaces the TextInfos with it. takeStateChanged is true (once) if anything saved changed since.
+	BandState saveState();
+	void restoreState(BandState state);
+	bool takeStateChanged();
+
+	// UI thread: the band is now width x height (which also posts EVENT_SIZE)
+	void onSizeChanged(int32_t width, int32_t height);
+
+	// Any thread: the width the content needs, for GetBandInfo. 0 while there are no TextInfos.
+	LONG getBandExtent() const;
+
+	// UI thread: tells the clients subscribed to it that something happened to the band (see EventQueue.h)
+	void postEvent(uint32_t type, int32_t value0 = 0, int32_t value1 = 0);
 
 	void stopAsyncResponseThread();
 
 private:
 
 	void asyncHandlingLoop();
-	void sendStopMessageToAsyncResponseThread();
-	std::string processRequest(std::string message);
-
-	HANDLE hPipe;
+	bool createPipes();
+	void serviceClient(PipeClient& client);
+	void connectClient(PipeClient& client);
+	void reconnectClient(PipeClient& client);
+	void startRead(PipeClient& client);
+	void readMore(PipeClient& client);
+	void startWrite(PipeClient& client);
+	void closeClient(PipeClient& client);
+	void sendEvents(PipeClient& client);
+	void appendEvent(PipeClient& client, const BandEvent& event);
+	void deliverEvents();
+	void queueCurrentState(PipeClient& client);
+	void updateSubscriptions();
+	void handleRequest(PipeClient& client, const char* data, size_t size);
+	void processRequest(PipeClient& client, const Request& request, Response& response);
+	void publishChanges();
+	void applyRestoredState();
+	std::optional<TextInfoHandle> createTextInfo();
+	void remeasureTextInfos();
+	void relayoutTextInfos();
+	void stepAnimations();
+	void applyAnimation(TextInfo& textInfo, const Animation& animation, const double* values);
+	void pollSharedState();
+
+	// Which of the process's bands this is, naming its pipe and shared state. -1 if there were none left.
+	int instanceId;
+	std::vector<std::unique_ptr<PipeClient>> clients;
+	HANDLE hStopEvent;
+	// Wakes the loop for work posted from the UI thread (see fontChanged)
+	HANDLE hWakeEvent;
 	std::thread asyncResponseThread;
 	CDeskBand* deskband;
 
-	std::vector<TextInfo> textInfos;
-	std::map<DWORD, std::string> msgToAction;
+	Stats stats;
+
+	// Set by the pipe thread when anything saved by saveState changes
+	std::atomic<bool> stateChanged;
+	// From Load, waiting for the pipe thread
+	std::mutex restoreMutex;
+	std::optional<BandState> pendingRestore;
+	std::atomic<bool> restorePending;
+
+	// Posted by the UI thread, sent by the pipe thread. takenEvents is reused by every deliverEvents().
+	EventQueue eventQueue;
+	std::vector<BandEvent> takenEvents;
+
+	// Edited by the pipe thread, painted by the UI thread from snapshots. Nothing is locked while a request runs.
+	TextInfoStore textInfoStore;
+	GraphStore graphStore;
+
+	// Area that must be invalidated once the current request's changes are published
+	RECT pendingInvalidation;
+	// Set when a TextInfo or graph actually changed since the last PAINT (pipe thread only)
+	bool contentDirty;
+	// Set by the UI thread when text needs measuring again. The pipe thread owns the TextInfos, so it does that.
+	std::atomic<bool> fontChanged;
+	// Set by the UI thread when the band's size changed, so the pipe thread lays TextInfos out again
+	std::atomic<bool> bandResized;
+
+	// SET,ANIMATION's. While animating is set, the repaint scheduler ticks every frame and each tick sets
+	// animationFrameDue, for the pipe thread to step them. A tick that comes while the last is still being stepped is
+	// dropped rather than queued.
+	Animator animator;
+	std::atomic<bool> animating;
+	std::atomic<bool> animationFrameDue;
+
+	// Set when a layout may resolve differently. layoutsInUse is cleared once resolving finds none enabled, so
+	// TextInfos all placed by SET,XY never pay for a pass over them.
+	bool layoutDirty;
+	bool layoutsInUse;
+	void markLayoutDirty();
+	void resolveLayouts();
+
+	// Recomputed from the TextInfos' rects whenever they're published, which never measures any text
+	BandExtent bandExtent;
+	void updateBandExtent();
+
+	// Rendered TextInfos (UI thread only). surfaceStaleRect is the area of it that needs rendering again. Both threads
+	// add to it, so it has its own lock, which is only ever held long enough to read or update the rect.
+	BackBuffer backBuffer;
+	std::mutex surfaceStaleMutex;
+	RECT surfaceStaleRect;
+	void renderStaleArea(const TextInfoStore::TextInfos& textInfos, const GraphStore::Items& graphs, const RECT& staleRect);
+	// reused for every graph's layout
+	std::vector<RECT> graphSpans;
+
+	// What renders TextInfos into backBuffer. requestedBackend is set by the pipe thread, the rest is the UI thread's.
+	std::atomic<RenderBackend> requestedBackend;
+	RenderBackend activeBackend;
+	D2DRenderer d2dRenderer;
+	RenderBackend chooseRenderBackend();
+	void paintUncomposited(HDC hdc, const RECT& paintRect, const TextInfoStore::TextInfos& textInfos, const GraphStore::Items& graphs);
+
+	// Text already drawn, and the scratch surface new runs are drawn on (UI thread only)
+	TextRunCache textRunCache;
+	BackBuffer textRunSurface;
+	const TextRun* renderTextRun(HTHEME hTheme, const TextInfo& textInfo, COLORREF color);
+	void drawText(HTHEME hTheme, HDC hdc, const TextInfo& textInfo, COLORREF color, RECT textRect);
+
+	// Slots written directly by other processes (see SharedState.h). Opened by the pipe thread on first use and kept
+	// until we go away. sharedTextInfos and sharedSequences are UI thread only.
+	SharedState sharedState;
+	std::atomic<bool> sharedStateEnabled;
+	TextInfoStore::TextInfos sharedTextInfos;
+	std::vector<uint32_t> sharedSequences;
+
+	void invalidate(const RECT& rect);
+	ActionDispatcher actions;
 	bool shouldStop;
 
-	SIZE getTextSize(const std::string &text);
+	// as drawText draws it
+	SIZE getTextSize(const std::wstring& text);
 	std::optional<size_t> textInfoTarget;
 
-	TextInfo* getTextInfoTarget();
+	// A handle rather than a pointer, since TextInfos may come and go. Empty if the target is out of bounds, or if
+	// there are no TextInfos and createIfEmpty is false (otherwise one is made).
+	std::optional<TextInfoHandle> getTextInfoTarget(bool createIfEmpty);
+
+	void measureTextInfo(TextInfo& textInfo);
+	void updateTextInfoExtent(TextInfo& textInfo);
+	RECT collectDirtyRect(bool all);
 };
 #pragma once
@@ -0,0 +1,105 @@
+#include "D2DRenderer.h"
+#include "Logger.h"
+
+#include <string>
+
+D2DRenderer::D2DRenderer()
+{
+    resources = NULL;
+    unavailable = false;
+}
+
+bool D2DRenderer::initialize(BandResources& bandResources)
+{
+    if (isInitialized() || unavailable)
+    {
+        return !unavailable;
+    }
+
+    // shared by every band in the process
+    resources = &bandResources;
+    if (!resources->getFactories(factory, writeFactory))
+    {
+        unavailable = true;
+        return false;
+    }
+    return true;
+}
+
+bool D2DRenderer::isInitialized() const
+{
+    return factory && writeFactory;
+}
+
+bool D2DRenderer::begin(HDC hdc, const RECT& area)
+{
+    if (!isInitialized() || IsRectEmpty(&area) || (!target && !createTarget()) || (!textFormat && !createTextFormat(hdc)))
+    {
+        return false;
+    }
+
+    if (FAILED(target->BindDC(hdc, &area)))
+    {
+        return false;
+    }
+
+    target->BeginDraw();
+    // the target's origin is area's top left
+    target->SetTransform(D2D1::Matrix3x2F::Translation((FLOAT)-area.left, (FLOAT)-area.top));
+    return true;
+}
+
+void D2DRenderer::drawText(const TextInfo& textInfo)
+{
+    brush->SetColor(D2D1::ColorF(textInfo.red / 255.0f, textInfo.green / 255.0f, textInfo.blue / 255.0f));
+    auto layoutRect = D2D1::RectF((FLOAT)textInfo.rect.left, (FLOAT)textInfo.rect.top, (FLOAT)textInfo.rect.right, (FLOAT)textInfo.rect.bottom);
+    target->DrawText(textInfo.wideText.c_str(), (UINT32)textInfo.wideText.size(), textFormat.Get(), layoutRect, brush.Get());
+}
+
+void D2DRenderer::end()
+{
+    if (target->EndDraw() == D2DERR_RECREATE_TARGET)
+    {
+        // made again on the next begin. The area is rendered again then, since it's stale anyway.
+        log(LogLevel::Warning, "Direct2D target was lost");
+        brush.Reset();
+        target.Reset();
+    }
+}
+
+void D2DRenderer::resetFont()
+{
+    textFormat.Reset();
+}
+
+bool D2DRenderer::createTarget()
+{
+    // premultiplied BGRA, like the back buffer. 96 DPI, so a DIP is a pixel.
+    auto properties = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED), 96.0f, 96.0f);
+    if (FAILED(factory->CreateDCRenderTarget(&properties, target.GetAddressOf())))
+    {
+        log(LogLevel::Error, "Failed to create Direct2D target");
+        return false;
+    }
+
+    // ClearType needs an opaque surface
+    target->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+    if (FAILED(target->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), brush.GetAddressOf())))
+    {
+        target.Reset();
+        return false;
+    }
+    return true;
+}
+
+bool D2DRenderer::createTextFormat(HDC hdc)
+{
+    // The same font GDI measures text with, so TextInfo rects fit
+    LOGFONTW logFont = { 0 };
+    GetObjectW(GetCurrentObject(hdc, OBJ_FONT), sizeof(logFont), &logFont);
+
+    // bands with the same font (that is, on monitors of the same DPI) share one
+    textFormat = resources->getTextFormat(logFont);
+    return (bool)textFormat;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "BandResources.h"
+#include "TextInfoStore.h"
+
+#include <Windows.h>
+#include <d2d1.h>
+#include <dwrite.h>
+#include <wrl/client.h>
+
+// Draws into a premultiplied 32bpp surface (the back buffer) through Direct2D and DirectWrite, as an alternative to
+// GDI + UxTheme. It binds to just the stale area of the surface, so partial updates stay partial, and what it draws
+// is composited exactly like the GDI path's output. Text is drawn without the theme's glow, which Direct2D has no
+// equivalent of short of an effects pipeline. UI thread only.
+class D2DRenderer
+{
+public:
+    D2DRenderer();
+
+    // Takes resources' factories (and later its text formats), the first time. Returns false if Direct2D isn't
+    // available (the GDI path is used instead).
+    bool initialize(BandResources& resources);
+    bool isInitialized() const;
+
+    // Draw calls between these land on area of hdc, which must have a 32bpp DIB selected. Coordinates are the
+    // surface's, not area's. Returns false if nothing can be drawn.
+    bool begin(HDC hdc, const RECT& area);
+    void drawText(const TextInfo& textInfo);
+    void end();
+
+    // The font changed, so the text format is built again (from the DC's font) on the next begin
+    void resetFont();
+
+private:
+    bool createTarget();
+    bool createTextFormat(HDC hdc);
+
+    // set by initialize
+    BandResources* resources;
+    Microsoft::WRL::ComPtr<ID2D1Factory> factory;
+    Microsoft::WRL::ComPtr<IDWriteFactory> writeFactory;
+    Microsoft::WRL::ComPtr<ID2D1DCRenderTarget> target;
+    Microsoft::WRL::ComPtr<ID2D1SolidColorBrush> brush;
+    Microsoft::WRL::ComPtr<IDWriteTextFormat> textFormat;
+    // initialize() failed, so it isn't tried again
+    bool unavailable;
+};
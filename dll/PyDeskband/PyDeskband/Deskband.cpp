@@ -15,8 +15,10 @@ static const WCHAR g_szDeskBandSampleClass[] = L"PyDeskband";
 
 
 CDeskBand::CDeskBand() :
-    m_cRef(1), m_pSite(NULL), m_fHasFocus(FALSE), m_fIsDirty(FALSE), m_dwBandID(0), m_hwnd(NULL), m_hwndParent(NULL)
+    m_cRef(1), m_pSite(NULL), m_fHasFocus(FALSE), m_fIsDirty(FALSE), m_dwBandID(0), m_hwnd(NULL), m_hwndParent(NULL), m_dpi(USER_DEFAULT_SCREEN_DPI)
 {
+    // the pipe claims its instance id from these, so they come first
+    m_resources = BandResources::acquire();
     m_controlPipe = std::make_unique<ControlPipe>(this);
 }
 
@@ -26,6 +28,10 @@ CDeskBand::~CDeskBand()
     {
         m_pSite->Release();
     }
+
+    // the pipe thread logs, so it has to be gone before the logger thread is (with the last band's resources)
+    m_controlPipe.reset();
+    m_resources.reset();
 }
 
 //
@@ -109,6 +115,7 @@ STDMETHODIMP CDeskBand::ShowDW(BOOL fShow)
     {
         ShowWindow(m_hwnd, fShow ? SW_SHOW : SW_HIDE);
     }
+    m_controlPipe->postEvent(EVENT_VISIBILITY, fShow ? 1 : 0);
 
     return S_OK;
 }
@@ -146,10 +153,13 @@ STDMETHODIMP CDeskBand::GetBandInfo(DWORD dwBandID, DWORD, DESKBANDINFO* pdbi)
     {
         m_dwBandID = dwBandID;
 
+        // Sizes are for 96 DPI, scaled to the monitor the band is on. Once there are TextInfos, the band is as wide
+        // as they need (so they're never clipped, and no room is left empty).
+        auto contentWidth = m_controlPipe->getBandExtent();
         if (pdbi->dwMask & DBIM_MINSIZE)
         {
-            pdbi->ptMinSize.x = 100;
-            pdbi->ptMinSize.y = 10;
+            pdbi->ptMinSize.x = contentWidth ? contentWidth : MulDiv(100, m_dpi, USER_DEFAULT_SCREEN_DPI);
+            pdbi->ptMinSize.y = MulDiv(10, m_dpi, USER_DEFAULT_SCREEN_DPI);
         }
 
         if (pdbi->dwMask & DBIM_MAXSIZE)
@@ -164,8 +174,8 @@ STDMETHODIMP CDeskBand::GetBandInfo(DWORD dwBandID, DWORD, DESKBANDINFO* pdbi)
 
         if (pdbi->dwMask & DBIM_ACTUAL)
         {
-            pdbi->ptActual.x = 200;
-            pdbi->ptActual.y = 30;
+            pdbi->ptActual.x = contentWidth ? contentWidth : MulDiv(200, m_dpi, USER_DEFAULT_SCREEN_DPI);
+            pdbi->ptActual.y = MulDiv(30, m_dpi, USER_DEFAULT_SCREEN_DPI);
         }
 
         if (pdbi->dwMask & DBIM_TITLE)
@@ -205,8 +215,8 @@ STDMETHODIMP CDeskBand::SetCompositionState(BOOL fCompositionEnabled)
 {
     m_fCompositionEnabled = fCompositionEnabled;
 
-    InvalidateRect(m_hwnd, NULL, TRUE);
-    UpdateWindow(m_hwnd);
+    // renders differently with and without composition, so everything is drawn again
+    m_controlPipe->onCompositionChanged();
 
     return S_OK;
 }
@@ -232,16 +242,76 @@ STDMETHODIMP CDeskBand::GetClassID(CLSID* pclsid)
 //
 STDMETHODIMP CDeskBand::IsDirty()
 {
+    // clients change the state through the control pipe
+    if (m_controlPipe->takeStateChanged())
+    {
+        m_fIsDirty = TRUE;
+    }
     return m_fIsDirty ? S_OK : S_FALSE;
 }
 
-STDMETHODIMP CDeskBand::Load(IStream* /*pStm*/)
+STDMETHODIMP CDeskBand::Load(IStream* pStm)
 {
+    char header[BAND_STATE_HEADER_SIZE];
+    ULONG read = 0;
+    if (FAILED(pStm->Read(header, sizeof(header), &read)) || read != sizeof(header))
+    {
+        // nothing saved yet: start out empty
+        return S_OK;
+    }
+
+    auto size = BandState::sizeFromHeader(header);
+    if (size == 0 || size > BAND_STATE_MAX_SIZE)
+    {
+        log(LogLevel::Warning, "Ignoring saved state: unknown version or too large");
+        return S_OK;
+    }
+
+    std::string data(header, sizeof(header));
+    data.resize(size);
+    if (FAILED(pStm->Read(&data[sizeof(header)], (ULONG)(size - sizeof(header)), &read)) || read != size - sizeof(header))
+    {
+        log(LogLevel::Warning, "Ignoring saved state: it was cut short");
+        return S_OK;
+    }
+
+    BandState state;
+    if (!state.parse(data))
+    {
+        log(LogLevel::Warning, "Ignoring saved state: it couldn't be parsed");
+        return S_OK;
+    }
+    m_controlPipe->restoreState(std::move(state));
+    m_fIsDirty = FALSE;
+
     return S_OK;
 }
 
-STDMETHODIMP CDeskBand::Save(IStream* /*pStm*/, BOOL fClearDirty)
+STDMETHODIMP CDeskBand::Save(IStream* pStm, BOOL fClearDirty)
 {
+    // taken first, so a change made while saving still counts as one
+    if (m_controlPipe->takeStateChanged())
+    {
+        m_fIsDirty = TRUE;
+    }
+
+    auto state = m_controlPipe->saveState();
+    auto data = state.serialize();
+    if (data.size() > BAND_STATE_MAX_SIZE)
+    {
+        // the settings and actions are still worth keeping
+        log(LogLevel::Warning, "TextInfos are too large to save: " + std::to_string(data.size()) + " bytes");
+        state.textInfos.clear();
+        data = state.serialize();
+    }
+
+    ULONG written = 0;
+    HRESULT hr = pStm->Write(data.data(), (ULONG)data.size(), &written);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
     if (fClearDirty)
     {
         m_fIsDirty = FALSE;
@@ -250,9 +320,11 @@ STDMETHODIMP CDeskBand::Save(IStream* /*pStm*/, BOOL fClearDirty)
     return S_OK;
 }
 
-STDMETHODIMP CDeskBand::GetSizeMax(ULARGE_INTEGER* /*pcbSize*/)
+STDMETHODIMP CDeskBand::GetSizeMax(ULARGE_INTEGER* pcbSize)
 {
-    return E_NOTIMPL;
+    auto size = m_controlPipe->saveState().serialize().size();
+    pcbSize->QuadPart = size < BAND_STATE_MAX_SIZE ? size : BAND_STATE_MAX_SIZE;
+    return S_OK;
 }
 
 //
@@ -365,6 +437,43 @@ void CDeskBand::OnFocus(const BOOL fFocus)
     }
 }
 
+void CDeskBand::OnThemeChanged()
+{
+    m_resources->onThemeChanged();
+
+    // the theme may come with a different font
+    m_controlPipe->onFontChanged();
+}
+
+void CDeskBand::OnDpiChanged()
+{
+    m_dpi = GetDpiForWindow(m_hwnd);
+    m_controlPipe->postEvent(EVENT_DPI, (int32_t)m_dpi);
+
+    // text is drawn with the theme (and font) for the new DPI, and measured again
+    m_controlPipe->onFontChanged();
+
+    // sizes are scaled by the DPI
+    OnBandInfoChanged();
+}
+
+void CDeskBand::OnBandInfoChanged()
+{
+    // the taskbar calls GetBandInfo again, and lays itself out for the new sizes
+    if (m_pSite)
+    {
+        IOleCommandTarget* pct;
+        if (SUCCEEDED(m_pSite->QueryInterface(IID_IOleCommandTarget, reinterpret_cast<void**>(&pct))))
+        {
+            VARIANT var;
+            var.vt = VT_I4;
+            var.lVal = m_dwBandID;
+            pct->Exec(&CGID_DeskBand, DBID_BANDINFOCHANGED, OLECMDEXECOPT_DODEFAULT, &var, NULL);
+            pct->Release();
+        }
+    }
+}
+
 LRESULT CALLBACK CDeskBand::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
     LRESULT lResult = 0;
@@ -377,6 +486,31 @@ LRESULT CALLBACK CDeskBand::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM
         pDeskBand = reinterpret_cast<CDeskBand*>(reinterpret_cast<CREATESTRUCT*>(lParam)->lpCreateParams);
         pDeskBand->m_hwnd = hwnd;
         SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(pDeskBand));
+        pDeskBand->m_dpi = GetDpiForWindow(hwnd);
+        pDeskBand->m_repaintScheduler.attach(hwnd);
+
+        // lets BeginBufferedPaint reuse its buffers instead of allocating one per paint
+        BufferedPaintInit();
+
+        // text restored by Load before the window existed was measured without its font
+        pDeskBand->m_controlPipe->onFontChanged();
+        break;
+
+    case WM_DESTROY:
+        if (pDeskBand)
+        {
+            pDeskBand->m_repaintScheduler.detach();
+        }
+        BufferedPaintUnInit();
+        break;
+
+    case WM_THEMECHANGED:
+        if (pDeskBand)
+        {
+            pDeskBand->OnThemeChanged();
+            // actions set for WM_THEMECHANGED see the refreshed theme
+            lResult = pDeskBand->m_controlPipe->msgHandler(uMsg);
+        }
         break;
 
     case WM_SETFOCUS:
@@ -387,9 +521,43 @@ LRESULT CALLBACK CDeskBand::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM
         pDeskBand->OnFocus(FALSE);
         break;
 
+    case WM_SIZE:
+        if (pDeskBand)
+        {
+            pDeskBand->m_controlPipe->onSizeChanged(LOWORD(lParam), HIWORD(lParam));
+            lResult = pDeskBand->m_controlPipe->msgHandler(uMsg);
+        }
+        break;
+
+    // a child window like ours only gets WM_DPICHANGED_AFTERPARENT, but either means the same
+    case WM_DPICHANGED:
+    case WM_DPICHANGED_AFTERPARENT:
+        if (pDeskBand)
+        {
+            pDeskBand->OnDpiChanged();
+            lResult = pDeskBand->m_controlPipe->msgHandler(uMsg);
+        }
+        break;
+
+    case WM_BAND_EXTENT_CHANGED:
+        if (pDeskBand)
+        {
+            pDeskBand->OnBandInfoChanged();
+        }
+        break;
+
+    case WM_REPAINT_SCHEDULED:
+    case WM_TIMER:
+        if (pDeskBand && !pDeskBand->m_repaintScheduler.handleMessage(uMsg, wParam))
+        {
+            // not one of ours, so it may still have an action set for it
+            lResult = pDeskBand->m_controlPipe->msgHandler(uMsg);
+        }
+        break;
+
     case WM_PAINT:
     case WM_PRINTCLIENT:
-        log("WM_PAINT/WM_PRINTCLIENT");
+        LOG(LogLevel::Verbose, "WM_PAINT/WM_PRINTCLIENT");
         pDeskBand->m_controlPipe->paintAllTextInfos();
         break;
     default:
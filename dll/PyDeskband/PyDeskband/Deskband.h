@@ -1,9 +1,12 @@
 #pragma once
 
+#include "BandResources.h"
 #include "ControlPipe.h"
+#include "RepaintScheduler.h"
 
 #include <windows.h>
 #include <shlobj.h> // for IDeskband2, IObjectWithSite, IPesistStream, and IInputObject
+#include <uxtheme.h>
 #include <thread>
 #include <string>
 #include <memory>
@@ -63,12 +66,18 @@ public:
 
     HWND                m_hwnd;                 // main window of deskband
     BOOL                m_fCompositionEnabled;  // whether glass is currently enabled in deskband
+    UINT                m_dpi;                  // DPI of the monitor the band is on
+    std::shared_ptr<BandResources> m_resources; // themes, fonts and factories shared with any other bands in explorer
+    RepaintScheduler    m_repaintScheduler;     // every invalidation of the window goes through here
 
 protected:
     ~CDeskBand();
 
     static LRESULT CALLBACK WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
     void OnFocus(const BOOL fFocus);
+    void OnThemeChanged();
+    void OnDpiChanged();
+    void OnBandInfoChanged();
 
 private:
     LONG                m_cRef;                 // ref count of deskband
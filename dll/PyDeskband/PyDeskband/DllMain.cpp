@@ -1,4 +1,5 @@
 #include "ClassFactory.h" // for the class factory
+#include "Tracing.h"
 
 #include <windows.h>
 #include <strsafe.h> // for StringCchXXX functions
@@ -18,6 +19,11 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, void* lpvReserved)
     {
         g_hInst = hInstance;
         DisableThreadLibraryCalls(hInstance);
+        registerTracing();
+    }
+    else if (dwReason == DLL_PROCESS_DETACH)
+    {
+        unregisterTracing();
     }
     return TRUE;
 }
@@ -0,0 +1,126 @@
+#include "EventQueue.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <string>
+
+void BandEvent::addTo(Response& response) const
+{
+    response.setStatus(Status::Event);
+    switch (type)
+    {
+    case EVENT_SIZE:
+        response.addField("SIZE");
+        response.addField((int64_t)values[0]);
+        response.addField((int64_t)values[1]);
+        break;
+    case EVENT_DPI:
+        response.addField("DPI");
+        response.addField((int64_t)values[0]);
+        break;
+    case EVENT_COMPOSITION:
+        response.addField("COMPOSITION");
+        response.addField((int64_t)values[0]);
+        break;
+    case EVENT_VISIBILITY:
+        response.addField("VISIBILITY");
+        response.addField((int64_t)values[0]);
+        break;
+    case EVENT_WIN_MSG:
+        response.addField("WIN_MSG");
+        response.addField((int64_t)values[0]);
+        break;
+    }
+}
+
+bool Subscription::wants(const BandEvent& event) const
+{
+    if (!(mask & event.type))
+    {
+        return false;
+    }
+    if (event.type == EVENT_WIN_MSG)
+    {
+        return std::find(messages.begin(), messages.end(), (DWORD)event.values[0]) != messages.end();
+    }
+    return true;
+}
+
+EventQueue::EventQueue()
+{
+    mask = 0;
+    for (auto& bits : messageBits)
+    {
+        bits = 0;
+    }
+    queued = false;
+}
+
+void EventQueue::update(const std::vector<const Subscription*>& subscriptions)
+{
+    uint32_t newMask = 0;
+    std::vector<uint32_t> newBits(EVENT_MESSAGES / 32);
+    for (auto subscription : subscriptions)
+    {
+        newMask |= subscription->mask;
+        if (subscription->mask & EVENT_WIN_MSG)
+        {
+            for (auto msg : subscription->messages)
+            {
+                if (msg < EVENT_MESSAGES)
+                {
+                    newBits[msg / 32] |= (1u << (msg % 32));
+                }
+            }
+        }
+    }
+
+    // only words that changed are stored, so bits that stay set are never briefly clear
+    for (size_t i = 0; i < newBits.size(); i++)
+    {
+        if (messageBits[i].load(std::memory_order_relaxed) != newBits[i])
+        {
+            messageBits[i].store(newBits[i], std::memory_order_relaxed);
+        }
+    }
+    mask = newMask;
+}
+
+bool EventQueue::post(const BandEvent& event)
+{
+    if (!(mask.load(std::memory_order_relaxed) & event.type))
+    {
+        return false;
+    }
+    if (event.type == EVENT_WIN_MSG)
+    {
+        auto msg = (uint32_t)event.values[0];
+        if (msg >= EVENT_MESSAGES || !(messageBits[msg / 32].load(std::memory_order_relaxed) & (1u << (msg % 32))))
+        {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (queue.size() >= EVENT_QUEUE_SIZE)
+    {
+        log(LogLevel::Warning, "Event queue is full, dropping event: " + std::to_string(event.type));
+        return false;
+    }
+    queue.push_back(event);
+    queued = true;
+    return true;
+}
+
+void EventQueue::take(std::vector<BandEvent>& out)
+{
+    out.clear();
+    if (!queued)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    out.swap(queue);
+    queued = false;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Bits of a SUBSCRIBE mask, one per kind of event
+#define EVENT_SIZE 0x01
+#define EVENT_DPI 0x02
+#define EVENT_COMPOSITION 0x04
+#define EVENT_VISIBILITY 0x08
+#define EVENT_WIN_MSG 0x10
+#define EVENT_ALL 0x1F
+
+#define EVENT_QUEUE_SIZE 256
+// Window message ids are 16 bits (registered ones are 0xC000 - 0xFFFF)
+#define EVENT_MESSAGES 0x10000
+
+// Something that happened to the band, for the clients that subscribed to it
+struct BandEvent
+{
+    // one of the EVENT_* bits
+    uint32_t type;
+    // SIZE: width, height. DPI: dpi. COMPOSITION / VISIBILITY: 0 or 1. WIN_MSG: the message id.
+    int32_t values[2];
+
+    // Gives response the EVENT status, then the event's name and its values
+    void addTo(Response& response) const;
+};
+
+// What one connection subscribed to
+struct Subscription
+{
+    uint32_t mask = 0;
+    // for EVENT_WIN_MSG
+    std::vector<DWORD> messages;
+
+    bool wants(const BandEvent& event) const;
+};
+
+// Carries events from the UI thread, where they happen, to the pipe thread, which sends them to subscribers. Posting is
+// turned away by a single atomic load when no one subscribed to the event, so WndProc can post for every message.
+class EventQueue
+{
+public:
+    EventQueue();
+
+    // Pipe thread: sets what is posted to what the given subscriptions want, combined
+    void update(const std::vector<const Subscription*>& subscriptions);
+
+    // UI thread. Returns true if the event was queued (then the pipe thread must be woken to send it).
+    bool post(const BandEvent& event);
+
+    // Pipe thread: moves every queued event into out (which is cleared first)
+    void take(std::vector<BandEvent>& out);
+
+private:
+    std::atomic<uint32_t> mask;
+    std::atomic<uint32_t> messageBits[EVENT_MESSAGES / 32];
+
+    std::mutex queueMutex;
+    std::vector<BandEvent> queue;
+    // set while queue isn't empty, so taking from an empty queue doesn't lock
+    std::atomic<bool> queued;
+};
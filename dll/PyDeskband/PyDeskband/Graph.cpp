@@ -0,0 +1,116 @@
+#include "Graph.h"
+
+#include <charconv>
+
+void Graph::setCapacity(size_t capacity)
+{
+    samples.assign(capacity, 0);
+    head = 0;
+    count = 0;
+    dirty = true;
+}
+
+size_t Graph::capacity() const
+{
+    return samples.size();
+}
+
+void Graph::append(int32_t sample)
+{
+    if (samples.empty())
+    {
+        return;
+    }
+
+    samples[head] = sample;
+    head = (head + 1) % samples.size();
+    if (count < samples.size())
+    {
+        count++;
+    }
+    dirty = true;
+}
+
+bool Graph::appendAll(std::string_view text)
+{
+    const char* cursor = text.data();
+    const char* end = text.data() + text.size();
+    while (cursor < end)
+    {
+        if (*cursor == ' ')
+        {
+            cursor++;
+            continue;
+        }
+
+        int32_t sample = 0;
+        auto result = std::from_chars(cursor, end, sample);
+        if (result.ec != std::errc() || (result.ptr != end && *result.ptr != ' '))
+        {
+            return false;
+        }
+        append(sample);
+        cursor = result.ptr;
+    }
+    return true;
+}
+
+void Graph::layout(std::vector<RECT>& spans) const
+{
+    spans.clear();
+    LONG width = rect.right - rect.left;
+    LONG height = rect.bottom - rect.top;
+    if (width <= 0 || height <= 0 || count == 0)
+    {
+        return;
+    }
+
+    LONG columnWidth = width / (LONG)samples.size();
+    if (columnWidth < 1)
+    {
+        columnWidth = 1;
+    }
+    size_t visible = (size_t)(width / columnWidth);
+    if (visible > count)
+    {
+        visible = count;
+    }
+
+    auto yOf = [&](int32_t sample)
+    {
+        // 0 at the bottom row, height - 1 at the top
+        LONG scaled = 0;
+        if (maximum > minimum)
+        {
+            int64_t clamped = sample < minimum ? minimum : (sample > maximum ? maximum : sample);
+            scaled = (LONG)((clamped - minimum) * (height - 1) / ((int64_t)maximum - minimum));
+        }
+        return rect.bottom - 1 - scaled;
+    };
+
+    // oldest visible sample first, ending at the right edge
+    size_t oldest = (head + samples.size() - visible) % samples.size();
+    LONG x = rect.right - (LONG)visible * columnWidth;
+    LONG previousY = 0;
+    for (size_t i = 0; i < visible; i++, x += columnWidth)
+    {
+        LONG y = yOf(samples[(oldest + i) % samples.size()]);
+        if (style == GraphStyle::Bars)
+        {
+            // leaves a gap between bars wide enough to have one
+            spans.push_back({ x, y, x + (columnWidth > 2 ? columnWidth - 1 : columnWidth), rect.bottom });
+        }
+        else
+        {
+            // the level of this sample, joined to the previous one by a vertical run
+            spans.push_back({ x, y, x + columnWidth, y + 1 });
+            if (i > 0 && previousY != y)
+            {
+                LONG top = previousY < y ? previousY : y;
+                LONG bottom = previousY < y ? y : previousY;
+                spans.push_back({ x, top, x + 1, bottom + 1 });
+            }
+        }
+        previousY = y;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "SlotStore.h"
+
+#include <Windows.h>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define GRAPH_MAX_CAPACITY 4096
+
+enum class GraphStyle
+{
+    // a 1px line through the samples
+    Line = 0,
+    // a filled bar per sample
+    Bars = 1,
+};
+
+// A fixed number of the latest samples of some value, drawn in rect as a sparkline or bar graph. Samples are scaled
+// from [minimum, maximum] to the height of rect (and clamped to it). Each sample gets rect's width / capacity columns
+// (at least 1), newest on the right. Samples that don't fit are not drawn.
+struct Graph
+{
+    RECT rect = { 0 };
+    unsigned red = 255;
+    unsigned green = 255;
+    unsigned blue = 255;
+    int32_t minimum = 0;
+    int32_t maximum = 100;
+    GraphStyle style = GraphStyle::Line;
+
+    // Set when something visible changed since the last PAINT. paintedRect is where it was when last invalidated.
+    bool dirty = true;
+    RECT paintedRect = { 0 };
+
+    // Drops all samples
+    void setCapacity(size_t capacity);
+    size_t capacity() const;
+    // Overwrites the oldest sample once full
+    void append(int32_t sample);
+    // Appends every integer in text, separated by spaces. Returns false (having appended those before it) if it
+    // finds something else.
+    bool appendAll(std::string_view text);
+
+    // The rects, in rect's pixels, that draw the graph in its color
+    void layout(std::vector<RECT>& spans) const;
+
+private:
+    // a ring: the oldest sample is at head once it's full
+    std::vector<int32_t> samples;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+typedef SlotHandle GraphHandle;
+typedef SlotStore<Graph> GraphStore;
@@ -0,0 +1,35 @@
+#include "Layout.h"
+
+static LONG alignedOffset(LONG length, LayoutAlign align)
+{
+    switch (align)
+    {
+    case LayoutAlign::Center:
+        return length / 2;
+    case LayoutAlign::End:
+        return length;
+    case LayoutAlign::Start:
+    default:
+        return 0;
+    }
+}
+
+POINT resolveLayout(const Layout& layout, SIZE textSize, SIZE bandSize, const RECT* previous)
+{
+    POINT topLeft;
+    topLeft.x = bandSize.cx * layout.xPercent / 100 + layout.xOffset - alignedOffset(textSize.cx, layout.horizontal);
+    topLeft.y = bandSize.cy * layout.yPercent / 100 + layout.yOffset - alignedOffset(textSize.cy, layout.vertical);
+
+    if (previous)
+    {
+        if (layout.flow == LayoutFlow::Below)
+        {
+            topLeft.y = previous->bottom + layout.gap + layout.yOffset;
+        }
+        else
+        {
+            topLeft.x = previous->right + layout.gap + layout.xOffset;
+        }
+    }
+    return topLeft;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "SlotStore.h"
+
+#include <Windows.h>
+
+// Passes over the TextInfos resolving layouts. Chains of TextInfos following each other in creation order settle in
+// one; this bounds chains in any other order (and cycles).
+#define LAYOUT_MAX_PASSES 16
+
+// Which part of the text sits on the anchor, along one axis
+enum class LayoutAlign
+{
+    Start = 0,
+    Center = 1,
+    End = 2,
+};
+
+// Where a layout that follows another TextInfo goes, relative to it
+enum class LayoutFlow
+{
+    Right = 0,
+    Below = 1,
+};
+
+// Where a TextInfo goes when the DLL places it (SET,LAYOUT), instead of the client (SET,XY). Resolved to a top left
+// whenever the text, the layout or the band's size changes, and kept in the TextInfo's rect until then.
+struct Layout
+{
+    bool enabled = false;
+
+    // The anchor: a percentage (0-100) of the band's size plus an offset in pixels
+    int xPercent = 0;
+    int yPercent = 0;
+    LONG xOffset = 0;
+    LONG yOffset = 0;
+    LayoutAlign horizontal = LayoutAlign::Start;
+    LayoutAlign vertical = LayoutAlign::Start;
+
+    // If set (0 is never a valid handle), the text stacks after this TextInfo instead: gap pixels past its right edge
+    // (or bottom) plus the offset. The other axis is anchored as usual. If it's gone, the anchor is used on both.
+    SlotHandle after = 0;
+    LayoutFlow flow = LayoutFlow::Right;
+    LONG gap = 0;
+};
+
+// The top left of text of textSize laid out in a band of bandSize. previous is the rect of the TextInfo it follows,
+// or NULL.
+POINT resolveLayout(const Layout& layout, SIZE textSize, SIZE bandSize, const RECT* previous);
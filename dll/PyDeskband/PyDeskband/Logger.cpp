@@ -2,28 +2,215 @@
 
 #include "Logger.h"
 
+#include <Windows.h>
 #include <atomic>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
 #include <mutex>
+#include <thread>
 
-static std::mutex logMutex;
+// Must be a power of 2
+#define LOG_RING_SLOTS 512
+#define LOG_SLOT_SIZE 1024
+#define LOG_FLUSH_INTERVAL_MS 50
+#define LOG_TRUNCATED_MARKER "..."
+
+// One queued message. sequence tells producers and the consumer whose turn the slot is (see logRingPush).
+struct LogSlot
+{
+	std::atomic<size_t> sequence;
+	size_t length;
+	char text[LOG_SLOT_SIZE];
+};
+
+// Bounded lock-free queue: any number of threads push, the logger thread is the only one that pops.
+struct LogRing
+{
+	LogRing()
+	{
+		for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+		{
+			slots[i].sequence = i;
+		}
+		enqueuePos = 0;
+		dequeuePos = 0;
+	}
+
+	LogSlot slots[LOG_RING_SLOTS];
+	std::atomic<size_t> enqueuePos;
+	size_t dequeuePos;
+};
+
+static LogRing logRing;
+static std::atomic<size_t> droppedMessages = 0;
 static std::atomic<bool> loggingEnabled = false;
+static std::atomic<int> logLevel = (int)LogLevel::Info;
 
-void log(const std::string& s)
+// Guards starting and stopping the logger thread, never logging itself
+static std::mutex loggerThreadMutex;
+static std::thread loggerThread;
+static HANDLE hLoggerStopEvent = NULL;
+
+static bool logRingPush(const std::string& s)
 {
-	if (loggingEnabled)
+	auto pos = logRing.enqueuePos.load(std::memory_order_relaxed);
+	LogSlot* slot;
+	for (;;)
+	{
+		slot = &logRing.slots[pos & (LOG_RING_SLOTS - 1)];
+		auto sequence = slot->sequence.load(std::memory_order_acquire);
+		auto diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0)
+		{
+			// the slot is free. Claim it, unless another producer got there first.
+			if (logRing.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// full: the logger thread hasn't gotten to this slot yet
+			return false;
+		}
+		else
+		{
+			pos = logRing.enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	auto length = s.size();
+	if (length > LOG_SLOT_SIZE)
 	{
-		logMutex.lock();
-		auto logFilePath = (std::filesystem::temp_directory_path() / "pydeskband.log");
-		std::ofstream outfile;
-		outfile.open(logFilePath, std::ios_base::app);
-		outfile << s << std::endl;
-		logMutex.unlock();
+		length = LOG_SLOT_SIZE - (sizeof(LOG_TRUNCATED_MARKER) - 1);
+		memcpy(slot->text, s.data(), length);
+		memcpy(slot->text + length, LOG_TRUNCATED_MARKER, sizeof(LOG_TRUNCATED_MARKER) - 1);
+		length = LOG_SLOT_SIZE;
 	}
+	else
+	{
+		memcpy(slot->text, s.data(), length);
+	}
+	slot->length = length;
+
+	// hands the slot to the consumer
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+// Logger thread only. Appends every queued message to out.
+static void logRingDrain(std::string& out)
+{
+	for (;;)
+	{
+		auto slot = &logRing.slots[logRing.dequeuePos & (LOG_RING_SLOTS - 1)];
+		if (slot->sequence.load(std::memory_order_acquire) != logRing.dequeuePos + 1)
+		{
+			break;
+		}
+
+		out.append(slot->text, slot->length);
+		out += "\r\n";
+
+		// hands the slot back to producers, a lap later
+		slot->sequence.store(logRing.dequeuePos + LOG_RING_SLOTS, std::memory_order_release);
+		logRing.dequeuePos++;
+	}
+}
+
+static void loggerThreadLoop(HANDLE hStopEvent)
+{
+	auto logFilePath = (std::filesystem::temp_directory_path() / "pydeskband.log");
+
+	// Kept open for as long as logging is on. Shared, so it can be tailed (or deleted) while we write to it.
+	HANDLE hFile = CreateFileW(logFilePath.wstring().c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	std::string batch;
+	bool stopping = false;
+	while (!stopping)
+	{
+		stopping = WaitForSingleObject(hStopEvent, LOG_FLUSH_INTERVAL_MS) != WAIT_TIMEOUT;
+
+		batch.clear();
+		logRingDrain(batch);
+
+		auto dropped = droppedMessages.exchange(0);
+		if (dropped)
+		{
+			batch += "(dropped " + std::to_string(dropped) + " messages)\r\n";
+		}
+
+		if (batch.size() && hFile != INVALID_HANDLE_VALUE)
+		{
+			DWORD written = 0;
+			WriteFile(hFile, batch.data(), (DWORD)batch.size(), &written, NULL);
+		}
+	}
+
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+	}
+}
+
+static void startLoggerThread()
+{
+	std::lock_guard<std::mutex> lock(loggerThreadMutex);
+	if (!loggerThread.joinable())
+	{
+		hLoggerStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		loggerThread = std::thread(loggerThreadLoop, hLoggerStopEvent);
+	}
+}
+
+bool isLogging(LogLevel level)
+{
+	return loggingEnabled && (int)level <= logLevel;
+}
+
+void log(LogLevel level, const std::string& s)
+{
+	if (isLogging(level) && !logRingPush(s))
+	{
+		droppedMessages++;
+	}
+}
+
+void log(const std::string& s)
+{
+	log(LogLevel::Info, s);
 }
 
 void setLoggingEnabled(bool enabled)
 {
-	loggingEnabled = enabled;
+	if (enabled)
+	{
+		startLoggerThread();
+		loggingEnabled = true;
+	}
+	else
+	{
+		stopLogging();
+	}
+}
+
+void setLogLevel(LogLevel level)
+{
+	logLevel = (int)level;
 }
+
+void stopLogging()
+{
+	loggingEnabled = false;
+
+	std::lock_guard<std::mutex> lock(loggerThreadMutex);
+	if (loggerThread.joinable())
+	{
+		// the thread writes out what's left before exiting
+		SetEvent(hLoggerStopEvent);
+		loggerThread.join();
+		CloseHandle(hLoggerStopEvent);
+		hLoggerStopEvent = NULL;
+	}
+}
\ No newline at end of file
@@ -2,5 +2,25 @@
 
 #include <string>
 
+// Lower is more severe. Messages above the current level are dropped before they're formatted (see LOG).
+enum class LogLevel : int
+{
+	Error = 0,
+	Warning = 1,
+	Info = 2,
+	Verbose = 3,
+};
+
+// Queues s to be written to %TEMP%/pydeskband.log by the logger thread. Never blocks: if the queue is full, s is dropped.
+void log(LogLevel level, const std::string& s);
 void log(const std::string& s);
-void setLoggingEnabled(bool enabled);
\ No newline at end of file
+bool isLogging(LogLevel level);
+
+void setLoggingEnabled(bool enabled);
+void setLogLevel(LogLevel level);
+
+// Writes out whatever is queued and stops the logger thread. Must not be called from DllMain (it joins a thread).
+void stopLogging();
+
+// Only builds the message if it would be logged. Use this for anything expensive to format or on a hot path.
+#define LOG(level, message) do { if (isLogging(level)) { log((level), (message)); } } while (0)
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "RepaintScheduler.h"
+
+RepaintScheduler::RepaintScheduler()
+{
+    hwnd = NULL;
+    SetRectEmpty(&pendingRect);
+    scheduled = false;
+    timerArmed = false;
+    timerRepeating = false;
+    maxFps = REPAINT_DEFAULT_MAX_FPS;
+    polling = 0;
+    lastFlush = 0;
+}
+
+void RepaintScheduler::attach(HWND hwnd)
+{
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    this->hwnd = hwnd;
+}
+
+void RepaintScheduler::detach()
+{
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (hwnd)
+    {
+        KillTimer(hwnd, REPAINT_TIMER_ID);
+    }
+    hwnd = NULL;
+    scheduled = false;
+    timerArmed = false;
+    timerRepeating = false;
+    SetRectEmpty(&pendingRect);
+}
+
+void RepaintScheduler::requestRepaint(const RECT& rect)
+{
+    if (IsRectEmpty(&rect))
+    {
+        return;
+    }
+
+    HWND postTo = NULL;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        UnionRect(&pendingRect, &pendingRect, &rect);
+
+        // Only the first request of a frame wakes the UI thread. The rest just grow the pending rect.
+        if (hwnd && !scheduled)
+        {
+            scheduled = true;
+            postTo = hwnd;
+        }
+    }
+
+    if (postTo)
+    {
+        // Timers belong to the thread that owns the window, so the UI thread arms it
+        PostMessage(postTo, WM_REPAINT_SCHEDULED, 0, 0);
+    }
+}
+
+bool RepaintScheduler::handleMessage(UINT msg, WPARAM wParam)
+{
+    if (msg == WM_REPAINT_SCHEDULED)
+    {
+        if (polling && !timerRepeating)
+        {
+            // A one-shot timer may already be armed with what was left of a frame. Replace it.
+            armRepeatingTimer();
+            return true;
+        }
+
+        if (timerArmed)
+        {
+            // the next tick flushes it
+            return true;
+        }
+
+        ULONGLONG interval = frameInterval();
+        ULONGLONG elapsed = GetTickCount64() - lastFlush;
+        if (elapsed >= interval)
+        {
+            flush();
+        }
+        else
+        {
+            SetTimer(hwnd, REPAINT_TIMER_ID, (UINT)(interval - elapsed), NULL);
+            timerArmed = true;
+        }
+        return true;
+    }
+
+    if (msg == WM_TIMER && wParam == REPAINT_TIMER_ID)
+    {
+        if (onTick)
+        {
+            onTick();
+        }
+
+        if (!polling)
+        {
+            KillTimer(hwnd, REPAINT_TIMER_ID);
+            timerArmed = false;
+            timerRepeating = false;
+        }
+        else if (!timerRepeating)
+        {
+            // keeps going, but a full frame apart rather than at the one-shot's remainder
+            armRepeatingTimer();
+        }
+        flush();
+        return true;
+    }
+
+    return false;
+}
+
+void RepaintScheduler::setMaxFps(unsigned fps)
+{
+    maxFps = fps;
+}
+
+unsigned RepaintScheduler::getMaxFps() const
+{
+    return maxFps;
+}
+
+void RepaintScheduler::setPolling(unsigned reason, bool enabled)
+{
+    if (enabled)
+    {
+        polling |= reason;
+    }
+    else
+    {
+        polling &= ~reason;
+    }
+
+    // Wake the UI thread so it arms the timer. Turning polling off takes effect on the next tick.
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (enabled && hwnd)
+    {
+        PostMessage(hwnd, WM_REPAINT_SCHEDULED, 0, 0);
+    }
+}
+
+void RepaintScheduler::armRepeatingTimer()
+{
+    // repeats until polling is turned off
+    UINT interval = frameInterval();
+    SetTimer(hwnd, REPAINT_TIMER_ID, interval > USER_TIMER_MINIMUM ? interval : USER_TIMER_MINIMUM, NULL);
+    timerArmed = true;
+    timerRepeating = true;
+}
+
+UINT RepaintScheduler::frameInterval() const
+{
+    unsigned fps = maxFps;
+    return fps ? 1000 / fps : 0;
+}
+
+void RepaintScheduler::flush()
+{
+    RECT rect;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        rect = pendingRect;
+        SetRectEmpty(&pendingRect);
+        scheduled = false;
+    }
+
+    lastFlush = GetTickCount64();
+    if (hwnd && !IsRectEmpty(&rect))
+    {
+        InvalidateRect(hwnd, &rect, TRUE);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Posted to the deskband window when a repaint is requested while none is scheduled
+#define WM_REPAINT_SCHEDULED (WM_APP + 1)
+#define REPAINT_TIMER_ID 1
+#define REPAINT_DEFAULT_MAX_FPS 60
+// Reasons to tick every frame. The scheduler polls while any of them is set.
+#define REPAINT_POLL_SHARED_STATE 0x1
+#define REPAINT_POLL_ANIMATION 0x2
+
+// Merges any number of repaint requests into at most one InvalidateRect per frame.
+// Requests can come from any thread. The window procedure forwards WM_REPAINT_SCHEDULED and WM_TIMER to handleMessage.
+class RepaintScheduler
+{
+public:
+    RepaintScheduler();
+
+    // UI thread
+    void attach(HWND hwnd);
+    void detach();
+    // Returns true if msg was the scheduler's
+    bool handleMessage(UINT msg, WPARAM wParam);
+
+    // Any thread
+    void requestRepaint(const RECT& rect);
+    // 0 means unlimited: every request is flushed as soon as the UI thread gets to it
+    void setMaxFps(unsigned fps);
+    unsigned getMaxFps() const;
+    // While polling for any reason, the scheduler ticks every frame even if nothing was requested
+    void setPolling(unsigned reason, bool enabled);
+
+    // Called on the UI thread at every tick, before pending requests are flushed (so it can add to them)
+    std::function<void()> onTick;
+
+private:
+    void flush();
+    void armRepeatingTimer();
+    UINT frameInterval() const;
+
+    HWND hwnd;
+    std::mutex pendingMutex;
+    RECT pendingRect;
+    bool scheduled;
+    bool timerArmed;
+    // the armed timer ticks every frameInterval() rather than once
+    bool timerRepeating;
+    std::atomic<unsigned> maxFps;
+    // REPAINT_POLL_* bits
+    std::atomic<unsigned> polling;
+    ULONGLONG lastFlush;
+};
@@ -0,0 +1,109 @@
+#include "SharedState.h"
+#include "Logger.h"
+
+#include <cstring>
+#include <string>
+
+#define SHARED_STATE_SIZE (sizeof(SharedStateHeader) + SHARED_STATE_SLOTS * sizeof(SharedStateSlot))
+
+SharedState::SharedState()
+{
+    hMapping = NULL;
+    header = NULL;
+    slots = NULL;
+}
+
+SharedState::~SharedState()
+{
+    close();
+}
+
+bool SharedState::open(const std::wstring& name)
+{
+    if (isOpen())
+    {
+        return true;
+    }
+
+    hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)SHARED_STATE_SIZE, name.c_str());
+    if (hMapping == NULL)
+    {
+        log(LogLevel::Error, "Failed to create shared state mapping: " + std::to_string(GetLastError()));
+        return false;
+    }
+
+    auto view = MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, SHARED_STATE_SIZE);
+    if (view == NULL)
+    {
+        log(LogLevel::Error, "Failed to map shared state: " + std::to_string(GetLastError()));
+        close();
+        return false;
+    }
+
+    // A new mapping is zeroed, which is an empty (hidden) slot with sequence 0.
+    header = (SharedStateHeader*)view;
+    slots = (SharedStateSlot*)(header + 1);
+    header->version = SHARED_STATE_VERSION;
+    header->slotCount = SHARED_STATE_SLOTS;
+    header->slotSize = sizeof(SharedStateSlot);
+
+    // written last: writers check it before touching anything else
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHARED_STATE_MAGIC;
+    return true;
+}
+
+void SharedState::close()
+{
+    if (header)
+    {
+        UnmapViewOfFile(header);
+        header = NULL;
+        slots = NULL;
+    }
+
+    if (hMapping)
+    {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+}
+
+bool SharedState::isOpen() const
+{
+    return header != NULL;
+}
+
+bool SharedState::readSlot(size_t index, uint32_t& lastSequence, SharedSlotValue& value) const
+{
+    if (!isOpen() || index >= SHARED_STATE_SLOTS)
+    {
+        return false;
+    }
+
+    auto& slot = slots[index];
+    auto before = slot.sequence.load(std::memory_order_acquire);
+    if (before == lastSequence || (before & 1))
+    {
+        return false;
+    }
+
+    value.flags = slot.flags;
+    value.x = slot.x;
+    value.y = slot.y;
+    value.red = slot.red;
+    value.green = slot.green;
+    value.blue = slot.blue;
+    value.textLength = slot.textLength < SHARED_STATE_TEXT_SIZE ? slot.textLength : SHARED_STATE_TEXT_SIZE;
+    memcpy(value.text, slot.text, value.textLength);
+
+    // If a writer started while we copied, what we have may be torn. We'll see it again next tick.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before)
+    {
+        return false;
+    }
+
+    lastSequence = before;
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A named file mapping of fixed-layout TextInfo slots, for values that change too often to send over the pipe.
+// Layout (little-endian, no padding): a SharedStateHeader followed by SHARED_STATE_SLOTS SharedStateSlots.
+// To update a slot, a writer:
+//     increments sequence (making it odd)
+//     writes the other fields
+//     increments sequence again (making it even)
+// Each band has its own mapping, named like its pipe (see instanceName). The band polls every slot on its repaint tick and picks up any whose sequence changed, skipping slots that are
+// mid-update until the next tick. Neither side ever waits on the other. Only one writer may use a slot at a time.
+#define SHARED_STATE_NAME TEXT("PyDeskbandSharedState")
+#define SHARED_STATE_MAGIC 0x53445950 // "PYDS"
+#define SHARED_STATE_VERSION 1
+#define SHARED_STATE_SLOTS 32
+#define SHARED_STATE_TEXT_SIZE 256
+
+// flags
+#define SHARED_SLOT_VISIBLE 0x1
+
+struct SharedStateHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;
+};
+
+struct SharedStateSlot
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t flags;
+    int32_t x;
+    int32_t y;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t reserved;
+    uint32_t textLength;
+    char text[SHARED_STATE_TEXT_SIZE]; // UTF-8, not NULL terminated
+};
+
+static_assert(sizeof(SharedStateHeader) == 16, "SharedStateHeader layout is shared with other processes");
+static_assert(sizeof(SharedStateSlot) == 280, "SharedStateSlot layout is shared with other processes");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "sequence must be a plain uint32 in memory");
+
+// A consistent copy of a slot's fields
+struct SharedSlotValue
+{
+    uint32_t flags;
+    int32_t x;
+    int32_t y;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint32_t textLength;
+    char text[SHARED_STATE_TEXT_SIZE];
+};
+
+class SharedState
+{
+public:
+    SharedState();
+    ~SharedState();
+
+    // Creates (or opens, if a writer got there first) the mapping called name
+    bool open(const std::wstring& name);
+    void close();
+    bool isOpen() const;
+
+    // Copies slot index into value if it changed since lastSequence, then updates lastSequence.
+    // Returns false if it didn't change or a writer is in the middle of updating it.
+    bool readSlot(size_t index, uint32_t& lastSequence, SharedSlotValue& value) const;
+
+private:
+    HANDLE hMapping;
+    SharedStateHeader* header;
+    SharedStateSlot* slots;
+};
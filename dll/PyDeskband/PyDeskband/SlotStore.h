@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// An item's handle: its slot index in the low bits and the slot's generation above them. Deleting an item bumps its
+// slot's generation, so a stale handle never finds whatever reuses the slot. Generations start at 1 (so 0 is never a
+// handle) and stay under 2^15, so handles are positive as int32 fields.
+typedef uint32_t SlotHandle;
+#define SLOT_HANDLE_INDEX_BITS 16
+#define SLOT_MAX_SLOTS (1 << SLOT_HANDLE_INDEX_BITS)
+#define SLOT_MAX_GENERATION 0x7FFF
+
+// Holds items shared between the pipe thread (the only writer) and the UI thread (which paints them).
+// The writer edits a private working copy and publishes an immutable snapshot of it once a request (or a whole
+// batch) is applied. Readers take the latest snapshot without waiting on the writer, and it can't change under them.
+// The working copy is a slot map: lookup by handle, creation and deletion are O(1), and deleting one item doesn't
+// move any other. Snapshots hold just the live items, in slot order.
+template <typename T>
+class SlotStore
+{
+public:
+    typedef std::vector<T> Items;
+    typedef std::shared_ptr<const Items> Snapshot;
+
+    SlotStore()
+    {
+        liveCount = 0;
+        modified = false;
+        published = std::make_shared<const Items>();
+        publishedGeneration = 0;
+    }
+
+    // Writer only. Everything but the const methods marks the working copy as changed.
+    // create() reuses the lowest freed slot after a clear(), and fails once SLOT_MAX_SLOTS are alive.
+    std::optional<SlotHandle> create()
+    {
+        size_t index;
+        if (freeSlots.size())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else if (slots.size() < SLOT_MAX_SLOTS)
+        {
+            index = slots.size();
+            slots.emplace_back();
+        }
+        else
+        {
+            return std::nullopt;
+        }
+
+        slots[index].live = true;
+        liveCount++;
+        modified = true;
+        newestHandle = handleOf(index);
+        return newestHandle;
+    }
+
+    bool remove(SlotHandle handle)
+    {
+        auto index = indexOf(handle);
+        if (!index)
+        {
+            return false;
+        }
+
+        release(slots[*index]);
+        freeSlots.push_back((uint16_t)*index);
+        liveCount--;
+        modified = true;
+
+        if (newestHandle == handle)
+        {
+            // falls back to the last live slot, as if the items were still a plain list
+            newestHandle.reset();
+            for (auto i = slots.size(); i > 0; i--)
+            {
+                if (slots[i - 1].live)
+                {
+                    newestHandle = handleOf(i - 1);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        // Every slot is freed (and its handles invalidated), lowest index on top, so creation starts over from slot 0
+        freeSlots.clear();
+        for (auto i = slots.size(); i > 0; i--)
+        {
+            if (slots[i - 1].live)
+            {
+                release(slots[i - 1]);
+            }
+            freeSlots.push_back((uint16_t)(i - 1));
+        }
+        liveCount = 0;
+        newestHandle.reset();
+        modified = true;
+    }
+
+    // Writer only. NULL if handle is not (or no longer) a live item.
+    T* edit(SlotHandle handle)
+    {
+        auto index = indexOf(handle);
+        if (!index)
+        {
+            return NULL;
+        }
+        modified = true;
+        return &slots[*index].item;
+    }
+
+    const T* find(SlotHandle handle) const
+    {
+        auto index = indexOf(handle);
+        return index ? &slots[*index].item : NULL;
+    }
+
+    // Writer only. The item in slot index, for targeting by position.
+    std::optional<SlotHandle> handleAt(size_t index) const
+    {
+        if (index < slots.size() && slots[index].live)
+        {
+            return handleOf(index);
+        }
+        return std::nullopt;
+    }
+
+    // Writer only. One past the highest slot index, for walking the slots with handleAt().
+    size_t slotCount() const
+    {
+        return slots.size();
+    }
+
+    // Writer only. The most recently created item that is still alive.
+    std::optional<SlotHandle> newest() const
+    {
+        return newestHandle;
+    }
+
+    size_t size() const
+    {
+        return liveCount;
+    }
+
+    // Writer only. Calls f(T&) for every live item.
+    template <typename F>
+    void forEach(F f)
+    {
+        modified = true;
+        for (auto& slot : slots)
+        {
+            if (slot.live)
+            {
+                f(slot.item);
+            }
+        }
+    }
+
+    // Writer only. Calls f(const T&) for every live item, leaving the working copy unchanged (so nothing is
+    // published for it)
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (auto& slot : slots)
+        {
+            if (slot.live)
+            {
+                f(slot.item);
+            }
+        }
+    }
+
+    // Writer only. Makes the working copy visible to readers if it was edited since the last publish.
+    // Returns true if a new snapshot was published.
+    bool publish()
+    {
+        if (!modified)
+        {
+            return false;
+        }
+
+        // Readers may still hold the previous snapshot, so this is always a fresh copy rather than an update in place.
+        auto items = std::make_shared<Items>();
+        items->reserve(liveCount);
+        for (auto& slot : slots)
+        {
+            if (slot.live)
+            {
+                items->push_back(slot.item);
+            }
+        }
+        std::atomic_store(&published, Snapshot(std::move(items)));
+        publishedGeneration++;
+        modified = false;
+        return true;
+    }
+
+    // Any thread.
+    Snapshot snapshot() const
+    {
+        return std::atomic_load(&published);
+    }
+
+    uint64_t generation() const
+    {
+        return publishedGeneration;
+    }
+
+    // Writer only. What generation() will be once the working copy is published, so it counts unpublished edits.
+    uint64_t workingGeneration() const
+    {
+        uint64_t current = publishedGeneration;
+        return modified ? current + 1 : current;
+    }
+
+private:
+    struct Slot
+    {
+        T item;
+        uint16_t generation = 1;
+        bool live = false;
+    };
+
+    static void release(Slot& slot)
+    {
+        slot.item = T();
+        slot.live = false;
+        slot.generation = slot.generation % SLOT_MAX_GENERATION + 1;
+    }
+
+    SlotHandle handleOf(size_t index) const
+    {
+        return ((SlotHandle)slots[index].generation << SLOT_HANDLE_INDEX_BITS) | (SlotHandle)index;
+    }
+
+    std::optional<size_t> indexOf(SlotHandle handle) const
+    {
+        auto index = (size_t)(handle & (SLOT_MAX_SLOTS - 1));
+        auto generation = handle >> SLOT_HANDLE_INDEX_BITS;
+        if (index < slots.size() && slots[index].live && slots[index].generation == generation)
+        {
+            return index;
+        }
+        return std::nullopt;
+    }
+
+    std::vector<Slot> slots;
+    // indices of dead slots, reused from the back
+    std::vector<uint16_t> freeSlots;
+    size_t liveCount;
+    std::optional<SlotHandle> newestHandle;
+    bool modified;
+
+    // only accessed through std::atomic_load / std::atomic_store
+    Snapshot published;
+    std::atomic<uint64_t> publishedGeneration;
+};
@@ -0,0 +1,207 @@
+#include "Stats.h"
+
+#include <string>
+
+static size_t bucketOf(uint64_t value)
+{
+    if (value < 4)
+    {
+        return (size_t)value;
+    }
+
+    size_t msb = 2;
+    while (msb < 63 && (value >> (msb + 1)))
+    {
+        msb++;
+    }
+
+    // the 2 bits after the most significant one pick the bucket within its power of 2
+    return (msb - 1) * 4 + (size_t)((value >> (msb - 2)) & 3);
+}
+
+static uint64_t bucketUpperBound(size_t bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+
+    size_t msb = bucket / 4 + 1;
+    uint64_t width = 1ull << (msb - 2);
+    return (4 + bucket % 4) * width + width - 1;
+}
+
+Histogram::Histogram()
+{
+    reset();
+}
+
+void Histogram::record(uint64_t value)
+{
+    buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    auto current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Histogram::reset()
+{
+    for (auto& bucket : buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total = 0;
+    sum = 0;
+    maximum = 0;
+}
+
+uint64_t Histogram::count() const
+{
+    return total;
+}
+
+uint64_t Histogram::mean() const
+{
+    uint64_t n = total;
+    return n ? sum / n : 0;
+}
+
+uint64_t Histogram::maxValue() const
+{
+    return maximum;
+}
+
+uint64_t Histogram::percentile(unsigned percent) const
+{
+    // counted from the buckets rather than total, which may be ahead of them while recording
+    uint64_t n = 0;
+    for (auto& bucket : buckets)
+    {
+        n += bucket.load(std::memory_order_relaxed);
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (n * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            // never more than the largest value actually recorded
+            auto bound = bucketUpperBound(i);
+            auto largest = maxValue();
+            return bound < largest ? bound : largest;
+        }
+    }
+    return maxValue();
+}
+
+void Histogram::addTo(Response& response, const char* name) const
+{
+    std::string prefix(name);
+    response.addOwnedField(prefix + "_count");
+    response.addField((int64_t)count());
+    response.addOwnedField(prefix + "_mean");
+    response.addField((int64_t)mean());
+    response.addOwnedField(prefix + "_p50");
+    response.addField((int64_t)percentile(50));
+    response.addOwnedField(prefix + "_p99");
+    response.addField((int64_t)percentile(99));
+    response.addOwnedField(prefix + "_max");
+    response.addField((int64_t)maxValue());
+}
+
+Stopwatch::Stopwatch()
+{
+    QueryPerformanceCounter(&start);
+}
+
+uint64_t Stopwatch::elapsedUs() const
+{
+    static LARGE_INTEGER frequency = []() { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+Stats::Stats()
+{
+    reset();
+}
+
+void Stats::recordRequest(Opcode opcode, uint64_t elapsedUs)
+{
+    auto group = (size_t)opcode >> 8;
+    auto index = (size_t)opcode & 0xFF;
+    if (group < STATS_OPCODE_GROUPS && index < STATS_OPCODES_PER_GROUP)
+    {
+        requests[group][index].fetch_add(1, std::memory_order_relaxed);
+    }
+    requestsTotal.fetch_add(1, std::memory_order_relaxed);
+    requestUs.record(elapsedUs);
+}
+
+void Stats::reset()
+{
+    for (auto& group : requests)
+    {
+        for (auto& count : group)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+    requestsTotal = 0;
+    pipeReadBytes = 0;
+    pipeWriteBytes = 0;
+    paints = 0;
+    requestUs.reset();
+    paintUs.reset();
+    drawTextUs.reset();
+    resetTime = GetTickCount64();
+}
+
+void Stats::addTo(Response& response) const
+{
+    auto elapsedMs = GetTickCount64() - resetTime;
+
+    response.addField("elapsed_ms");
+    response.addField((int64_t)elapsedMs);
+    response.addField("requests");
+    response.addField((int64_t)requestsTotal);
+
+    for (size_t group = 0; group < STATS_OPCODE_GROUPS; group++)
+    {
+        for (size_t index = 0; index < STATS_OPCODES_PER_GROUP; index++)
+        {
+            auto count = requests[group][index].load(std::memory_order_relaxed);
+            if (count)
+            {
+                response.addOwnedField("requests." + opcodeToString((Opcode)((group << 8) | index)));
+                response.addField((int64_t)count);
+            }
+        }
+    }
+
+    requestUs.addTo(response, "request_us");
+
+    response.addField("pipe_read_bytes");
+    response.addField((int64_t)pipeReadBytes);
+    response.addField("pipe_write_bytes");
+    response.addField((int64_t)pipeWriteBytes);
+
+    response.addField("paints");
+    response.addField((int64_t)paints);
+    response.addField("paints_per_sec");
+    response.addField((int64_t)(elapsedMs ? paints * 1000 / elapsedMs : 0));
+    paintUs.addTo(response, "paint_us");
+    drawTextUs.addTo(response, "draw_text_us");
+}
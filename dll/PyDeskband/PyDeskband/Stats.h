@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+
+// 4 buckets per power of 2 (so within 25%), covering all of uint64
+#define HISTOGRAM_BUCKETS 252
+
+// Opcodes are (group << 8) | index, see Transport.h
+#define STATS_OPCODE_GROUPS 4
+#define STATS_OPCODES_PER_GROUP 32
+
+// Counts values (microseconds, usually) into logarithmic buckets. Any thread may record, without locking.
+class Histogram
+{
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t mean() const;
+    uint64_t maxValue() const;
+    // An upper bound on the value at the given percentile (0-100)
+    uint64_t percentile(unsigned percent) const;
+
+    // Adds <name>_count, <name>_mean, <name>_p50, <name>_p99 and <name>_max to response
+    void addTo(Response& response, const char* name) const;
+
+private:
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maximum;
+};
+
+// Measures how long it has been around for, in microseconds
+class Stopwatch
+{
+public:
+    Stopwatch();
+    uint64_t elapsedUs() const;
+
+private:
+    LARGE_INTEGER start;
+};
+
+// Counters for GET,STATS. The pipe thread and the UI thread both record into these, so everything is atomic (and
+// relaxed: the numbers only need to add up eventually, not to be consistent with each other at any given moment).
+class Stats
+{
+public:
+    Stats();
+
+    void recordRequest(Opcode opcode, uint64_t elapsedUs);
+
+    std::atomic<uint64_t> pipeReadBytes;
+    std::atomic<uint64_t> pipeWriteBytes;
+    std::atomic<uint64_t> paints;
+    Histogram requestUs;
+    Histogram paintUs;
+    Histogram drawTextUs;
+
+    void reset();
+
+    // Adds every stat to response as name, value pairs
+    void addTo(Response& response) const;
+
+private:
+    std::atomic<uint64_t> requests[STATS_OPCODE_GROUPS][STATS_OPCODES_PER_GROUP];
+    std::atomic<uint64_t> requestsTotal;
+    std::atomic<ULONGLONG> resetTime;
+};
@@ -0,0 +1,19 @@
+#include "TextInfoStore.h"
+
+std::string TextInfo::toString() const
+{
+    std::string retString = "";
+    retString += "TextInfo\n";
+    retString += "  Red:      " + std::to_string(red) + "\n";
+    retString += "  Green:    " + std::to_string(green) + "\n";
+    retString += "  Blue:     " + std::to_string(blue) + "\n";
+    retString += "  Rect:\n";
+    retString += "    Left:   " + std::to_string(rect.left) + "\n";
+    retString += "    Top:    " + std::to_string(rect.top) + "\n";
+    retString += "    Right:  " + std::to_string(rect.right) + "\n";
+    retString += "    Bottom: " + std::to_string(rect.bottom) + "\n";
+    retString += "  Layout:   " + std::to_string(layout.enabled) + "\n";
+    retString += "  Dirty:    " + std::to_string(dirty) + "\n";
+    retString += "  Text:     " + text + "\n";
+    return retString;
+}
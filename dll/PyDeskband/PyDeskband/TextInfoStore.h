@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Layout.h"
+#include "SlotStore.h"
+
+#include <Windows.h>
+#include <string>
+
+typedef SlotHandle TextInfoHandle;
+
+struct TextInfo
+{
+    unsigned red = 0;
+    unsigned green = 0;
+    unsigned blue = 0;
+
+    // its own, so readers of a snapshot can tell which TextInfo a layout follows
+    TextInfoHandle handle = 0;
+
+    std::string text;
+    RECT rect = { 0 };
+    // if enabled, places rect instead of SET,XY
+    Layout layout;
+
+    // Cached from text, so painting doesn't need to convert or measure it again
+    std::wstring wideText;
+    SIZE textSize = { 0 };
+
+    // Set when something visible changed since the last PAINT. paintedRect is where it was when last invalidated.
+    bool dirty = true;
+    RECT paintedRect = { 0 };
+
+    std::string toString() const;
+};
+
+// The TextInfos drawn by the band (see SlotStore)
+class TextInfoStore : public SlotStore<TextInfo>
+{
+public:
+    typedef Items TextInfos;
+};
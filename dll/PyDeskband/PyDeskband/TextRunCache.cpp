@@ -0,0 +1,111 @@
+#include "TextRunCache.h"
+
+#include <functional>
+
+bool TextRunCache::Key::operator==(const Key& other) const
+{
+    return color == other.color && width == other.width && height == other.height && text == other.text;
+}
+
+size_t TextRunCache::KeyHash::operator()(const Key& key) const
+{
+    size_t hash = std::hash<std::wstring>()(key.text);
+    hash ^= (size_t)key.color * 2654435761u;
+    hash ^= ((size_t)key.width << 16) ^ (size_t)key.height;
+    return hash;
+}
+
+TextRunCache::TextRunCache()
+{
+    maxEntries = TEXT_RUN_CACHE_DEFAULT_ENTRIES;
+    bytes = 0;
+    hits = 0;
+    misses = 0;
+}
+
+void TextRunCache::setMaxEntries(size_t maxEntries)
+{
+    this->maxEntries = maxEntries;
+}
+
+size_t TextRunCache::getMaxEntries() const
+{
+    return maxEntries;
+}
+
+bool TextRunCache::isEnabled() const
+{
+    return maxEntries > 0;
+}
+
+const TextRun* TextRunCache::find(const std::wstring& text, COLORREF color, SIZE textSize)
+{
+    if (!isEnabled())
+    {
+        clear();
+        return NULL;
+    }
+
+    auto found = index.find({ text, color, textSize.cx, textSize.cy });
+    if (found == index.end())
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    runs.splice(runs.begin(), runs, found->second);
+    return &found->second->second;
+}
+
+const TextRun* TextRunCache::insert(const std::wstring& text, COLORREF color, SIZE textSize, const BackBuffer& surface, const RECT& area)
+{
+    TextRun run;
+    run.width = area.right - area.left;
+    run.height = area.bottom - area.top;
+    run.pixels.resize((size_t)run.width * run.height);
+    surface.copyTo(run.pixels.data(), area);
+
+    auto runBytes = run.pixels.size() * sizeof(DWORD);
+    auto limit = maxEntries.load();
+    if (limit == 0 || runBytes > TEXT_RUN_CACHE_MAX_BYTES)
+    {
+        evict(limit, TEXT_RUN_CACHE_MAX_BYTES);
+        return NULL;
+    }
+
+    // room for this one
+    evict(limit - 1, TEXT_RUN_CACHE_MAX_BYTES - runBytes);
+
+    Key key = { text, color, textSize.cx, textSize.cy };
+    auto existing = index.find(key);
+    if (existing != index.end())
+    {
+        bytes -= existing->second->second.pixels.size() * sizeof(DWORD);
+        runs.erase(existing->second);
+        index.erase(existing);
+    }
+
+    runs.emplace_front(key, std::move(run));
+    index[key] = runs.begin();
+    bytes += runBytes;
+    return &runs.front().second;
+}
+
+void TextRunCache::clear()
+{
+    runs.clear();
+    index.clear();
+    bytes = 0;
+}
+
+void TextRunCache::evict(size_t maxEntries, size_t maxBytes)
+{
+    while (runs.size() && (runs.size() > maxEntries || bytes > maxBytes))
+    {
+        auto& oldest = runs.back();
+        bytes -= oldest.second.pixels.size() * sizeof(DWORD);
+        index.erase(oldest.first);
+        runs.pop_back();
+    }
+}
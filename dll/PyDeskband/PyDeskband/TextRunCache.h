@@ -0,0 +1,74 @@
+#pragma once
+
+#include "BackBuffer.h"
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TEXT_RUN_CACHE_DEFAULT_ENTRIES 256
+// Runs are evicted past this many bytes of pixels too, however many entries are allowed
+#define TEXT_RUN_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
+// Text already drawn (glow and all) onto a transparent, premultiplied surface
+struct TextRun
+{
+    LONG width = 0;
+    LONG height = 0;
+    std::vector<DWORD> pixels;
+};
+
+// The most recently drawn text runs, keyed on what goes into drawing them: the text, its color and its measured size
+// (which changes along with the font). Drawing themed text with a glow is by far the most expensive part of a paint,
+// and values like counters and percentages keep coming back, so a hit is just a blend of the cached pixels.
+// UI thread only, apart from setMaxEntries.
+class TextRunCache
+{
+public:
+    TextRunCache();
+
+    // Any thread. 0 turns the cache off, which empties it on the next use.
+    void setMaxEntries(size_t maxEntries);
+    size_t getMaxEntries() const;
+    bool isEnabled() const;
+
+    // Counts as a use, for eviction. NULL if it isn't cached.
+    const TextRun* find(const std::wstring& text, COLORREF color, SIZE textSize);
+    // Keeps a copy of the given area of surface as the run for text. Returns the cached copy.
+    const TextRun* insert(const std::wstring& text, COLORREF color, SIZE textSize, const BackBuffer& surface, const RECT& area);
+    void clear();
+
+    // for GET,STATS
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+
+private:
+    struct Key
+    {
+        std::wstring text;
+        COLORREF color;
+        LONG width;
+        LONG height;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    typedef std::list<std::pair<Key, TextRun>> Runs;
+
+    void evict(size_t maxEntries, size_t maxBytes);
+
+    std::atomic<size_t> maxEntries;
+    // most recently used first
+    Runs runs;
+    std::unordered_map<Key, Runs::iterator, KeyHash> index;
+    size_t bytes;
+};
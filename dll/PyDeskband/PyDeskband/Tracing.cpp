@@ -0,0 +1,15 @@
+#include "Tracing.h"
+
+// {cdb3fcfc-8ce3-4b89-afc4-4465f524aee3}
+TRACELOGGING_DEFINE_PROVIDER(g_traceProvider, "PyDeskband",
+    (0xcdb3fcfc, 0x8ce3, 0x4b89, 0xaf, 0xc4, 0x44, 0x65, 0xf5, 0x24, 0xae, 0xe3));
+
+void registerTracing()
+{
+    TraceLoggingRegister(g_traceProvider);
+}
+
+void unregisterTracing()
+{
+    TraceLoggingUnregister(g_traceProvider);
+}
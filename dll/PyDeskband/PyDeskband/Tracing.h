@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <TraceLoggingActivity.h>
+#include <winmeta.h>
+
+// ETW provider for the pipe and paint hot paths. Unlike the log, this costs next to nothing unless a session
+// is listening. To record (then open the .etl in WPA):
+//     xperf -start pydeskband -on cdb3fcfc-8ce3-4b89-afc4-4465f524aee3 -f pydeskband.etl
+//     xperf -stop pydeskband
+// Start/stop pairs are written through TraceLoggingActivity, so each region gets an activity ID to line up with
+// explorer's UI thread and DWM frames.
+TRACELOGGING_DECLARE_PROVIDER(g_traceProvider);
+
+// keywords
+#define TRACE_KEYWORD_PIPE 0x1
+#define TRACE_KEYWORD_PAINT 0x2
+
+typedef TraceLoggingActivity<g_traceProvider, TRACE_KEYWORD_PIPE, WINEVENT_LEVEL_INFO> PipeTraceActivity;
+typedef TraceLoggingActivity<g_traceProvider, TRACE_KEYWORD_PAINT, WINEVENT_LEVEL_INFO> PaintTraceActivity;
+// DrawThemeTextEx runs once per TextInfo per paint, so it's only traced at the verbose level
+typedef TraceLoggingActivity<g_traceProvider, TRACE_KEYWORD_PAINT, WINEVENT_LEVEL_VERBOSE> DrawTextTraceActivity;
+
+// Called from DllMain
+void registerTracing();
+void unregisterTracing();
@@ -0,0 +1,481 @@
+#include "Transport.h"
+
+#include <charconv>
+#include <cstring>
+
+#define TRANSPORT_DELIM ','
+
+struct OpcodeName
+{
+    Opcode opcode;
+    const char* verb;
+    const char* noun; // NULL for commands without a second keyword
+};
+
+static const OpcodeName OPCODE_NAMES[] = {
+    { Opcode::GetWidth, "GET", "WIDTH" },
+    { Opcode::GetHeight, "GET", "HEIGHT" },
+    { Opcode::GetTextSize, "GET", "TEXTSIZE" },
+    { Opcode::GetTextInfoCount, "GET", "TEXTINFOCOUNT" },
+    { Opcode::GetTextInfoTarget, "GET", "TEXTINFO_TARGET" },
+    { Opcode::GetRgb, "GET", "RGB" },
+    { Opcode::GetText, "GET", "TEXT" },
+    { Opcode::GetXY, "GET", "XY" },
+    { Opcode::GetTransportVersion, "GET", "TRANSPORT_VERSION" },
+    { Opcode::GetStats, "GET", "STATS" },
+    { Opcode::GetAll, "GET", "ALL" },
+    { Opcode::GetInstance, "GET", "INSTANCE" },
+
+    { Opcode::SetRgb, "SET", "RGB" },
+    { Opcode::SetText, "SET", "TEXT" },
+    { Opcode::SetXY, "SET", "XY" },
+    { Opcode::SetWinMsg, "SET", "WIN_MSG" },
+    { Opcode::SetTextInfoTarget, "SET", "TEXTINFO_TARGET" },
+    { Opcode::SetLoggingEnabled, "SET", "LOGGING_ENABLED" },
+    { Opcode::SetTransportVersion, "SET", "TRANSPORT_VERSION" },
+    { Opcode::SetMaxFps, "SET", "MAX_FPS" },
+    { Opcode::SetLogLevel, "SET", "LOG_LEVEL" },
+    { Opcode::SetSharedState, "SET", "SHARED_STATE" },
+    { Opcode::SetTextRunCache, "SET", "TEXT_RUN_CACHE" },
+    { Opcode::SetRenderer, "SET", "RENDERER" },
+    { Opcode::SetGraph, "SET", "GRAPH" },
+    { Opcode::SetLayout, "SET", "LAYOUT" },
+    { Opcode::SetAnimation, "SET", "ANIMATION" },
+
+    { Opcode::NewTextInfo, "NEW_TEXTINFO", NULL },
+    { Opcode::Paint, "PAINT", NULL },
+    { Opcode::Clear, "CLEAR", NULL },
+    { Opcode::Stop, "STOP", NULL },
+    { Opcode::SendWindowMessage, "SENDMESSAGE", NULL },
+    { Opcode::DeleteTextInfo, "DELETE_TEXTINFO", NULL },
+    { Opcode::NewGraph, "NEW_GRAPH", NULL },
+    { Opcode::DeleteGraph, "DELETE_GRAPH", NULL },
+    { Opcode::AppendGraph, "GRAPH_APPEND", NULL },
+    { Opcode::Subscribe, "SUBSCRIBE", NULL },
+};
+
+static const char* statusToString(Status status)
+{
+    switch (status)
+    {
+    case Status::Ok:
+        return "OK";
+    case Status::TextInfoTargetInvalid:
+        return "TextInfoTargetInvalid";
+    case Status::MsgNotFound:
+        return "MSG_NOT_FOUND";
+    case Status::GraphNotFound:
+        return "GRAPH_NOT_FOUND";
+    case Status::Event:
+        return "EVENT";
+    case Status::BadCommand:
+    default:
+        return "BadCommand";
+    }
+}
+
+template <typename T>
+static bool readValue(const char*& cursor, const char* end, T& value)
+{
+    if ((size_t)(end - cursor) < sizeof(T))
+    {
+        return false;
+    }
+    memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+template <typename T>
+static void writeValue(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+size_t split(std::string_view s, char delim, std::string_view* tokens, size_t maxTokens)
+{
+    size_t count = 0;
+    while (count < maxTokens)
+    {
+        auto pos = s.find(delim);
+        tokens[count++] = s.substr(0, pos);
+        if (pos == std::string_view::npos)
+        {
+            break;
+        }
+        s.remove_prefix(pos + 1);
+    }
+    return count;
+}
+
+// Reads "<prefix><number>," off the front of message into value, if it starts with prefix. False if it's malformed.
+static bool parseTextPrefix(std::string_view& message, char prefix, std::optional<uint32_t>& value)
+{
+    if (message.empty() || message[0] != prefix)
+    {
+        return true;
+    }
+
+    auto end = message.find(TRANSPORT_DELIM);
+    if (end == std::string_view::npos)
+    {
+        return false;
+    }
+
+    uint32_t number = 0;
+    auto result = std::from_chars(message.data() + 1, message.data() + end, number);
+    if (result.ec != std::errc() || result.ptr != message.data() + end)
+    {
+        return false;
+    }
+    value = number;
+    message.remove_prefix(end + 1);
+    return true;
+}
+
+bool parseTextRequest(std::string_view message, Request& request)
+{
+    if (!parseTextPrefix(message, TRANSPORT_ID_PREFIX, request.id) || !parseTextPrefix(message, TRANSPORT_TARGET_PREFIX, request.target))
+    {
+        return false;
+    }
+
+    // +2 for the verb and noun, and +1 more to tell too many fields from just enough
+    std::string_view tokens[TRANSPORT_MAX_FIELDS + 3];
+    auto tokenCount = split(message, TRANSPORT_DELIM, tokens, TRANSPORT_MAX_FIELDS + 3);
+    if (tokenCount > TRANSPORT_MAX_FIELDS + 2)
+    {
+        // rather than running the command with its last fields cut off
+        return false;
+    }
+
+    for (auto& name : OPCODE_NAMES)
+    {
+        if (tokens[0] != name.verb)
+        {
+            continue;
+        }
+
+        size_t firstField = 1;
+        if (name.noun)
+        {
+            if (tokenCount < 2 || tokens[1] != name.noun)
+            {
+                continue;
+            }
+            firstField = 2;
+        }
+
+        request.opcode = name.opcode;
+        for (size_t i = firstField; i < tokenCount; i++)
+        {
+            request.addField({ FIELD_TYPE_TEXT, 0, tokens[i] });
+        }
+        return true;
+    }
+
+    return false;
+}
+
+size_t parseBinaryRequest(const char* data, size_t size, Request& request)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+
+    uint32_t length = 0;
+    if (!readValue(cursor, end, length) || length > (size_t)(end - cursor))
+    {
+        return 0;
+    }
+    end = cursor + length;
+
+    uint16_t opcode = 0;
+    uint8_t fieldCount = 0;
+    if (!readValue(cursor, end, opcode) || !readValue(cursor, end, fieldCount))
+    {
+        return 0;
+    }
+    if (opcode & OPCODE_FLAG_ID)
+    {
+        uint32_t id = 0;
+        if (!readValue(cursor, end, id))
+        {
+            return 0;
+        }
+        request.id = id;
+        opcode &= ~OPCODE_FLAG_ID;
+    }
+    if (opcode & OPCODE_FLAG_TARGET)
+    {
+        uint32_t target = 0;
+        if (!readValue(cursor, end, target))
+        {
+            return 0;
+        }
+        request.target = target;
+        opcode &= ~OPCODE_FLAG_TARGET;
+    }
+    request.opcode = (Opcode)opcode;
+
+    for (uint8_t i = 0; i < fieldCount; i++)
+    {
+        uint8_t type = 0;
+        if (!readValue(cursor, end, type))
+        {
+            return 0;
+        }
+
+        if (type == FIELD_TYPE_INT)
+        {
+            int32_t value = 0;
+            if (!readValue(cursor, end, value) || !request.addField({ FIELD_TYPE_INT, value, {} }))
+            {
+                return 0;
+            }
+        }
+        else if (type == FIELD_TYPE_INT64)
+        {
+            int64_t value = 0;
+            if (!readValue(cursor, end, value) || !request.addField({ FIELD_TYPE_INT, value, {} }))
+            {
+                return 0;
+            }
+        }
+        else if (type == FIELD_TYPE_TEXT)
+        {
+            uint32_t textLength = 0;
+            if (!readValue(cursor, end, textLength) || textLength > (size_t)(end - cursor))
+            {
+                return 0;
+            }
+            if (!request.addField({ FIELD_TYPE_TEXT, 0, std::string_view(cursor, textLength) }))
+            {
+                return 0;
+            }
+            cursor += textLength;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    return end - data;
+}
+
+std::string opcodeToString(Opcode opcode)
+{
+    for (auto& name : OPCODE_NAMES)
+    {
+        if (name.opcode == opcode)
+        {
+            return name.noun ? std::string(name.verb) + "_" + name.noun : std::string(name.verb);
+        }
+    }
+    return std::to_string((uint16_t)opcode);
+}
+
+Request::Request()
+{
+    opcode = Opcode::Invalid;
+    fieldCount = 0;
+}
+
+size_t Request::size() const
+{
+    return fieldCount;
+}
+
+bool Request::addField(const Field& field)
+{
+    if (fieldCount >= TRANSPORT_MAX_FIELDS)
+    {
+        return false;
+    }
+    fields[fieldCount++] = field;
+    return true;
+}
+
+int64_t Request::getInt(size_t index) const
+{
+    if (index >= fieldCount)
+    {
+        throw BadRequestException("Missing field");
+    }
+
+    auto& field = fields[index];
+    if (field.type == FIELD_TYPE_INT)
+    {
+        return field.integer;
+    }
+
+    int64_t value = 0;
+    auto result = std::from_chars(field.text.data(), field.text.data() + field.text.size(), value);
+    if (result.ec != std::errc() || result.ptr != field.text.data() + field.text.size())
+    {
+        throw BadRequestException("Field is not an integer");
+    }
+    return value;
+}
+
+std::string_view Request::getText(size_t index) const
+{
+    if (index >= fieldCount)
+    {
+        throw BadRequestException("Missing field");
+    }
+
+    auto& field = fields[index];
+    if (field.type != FIELD_TYPE_TEXT)
+    {
+        throw BadRequestException("Field is not text");
+    }
+    return field.text;
+}
+
+bool Request::isText(size_t index) const
+{
+    return index < fieldCount && fields[index].type == FIELD_TYPE_TEXT;
+}
+
+std::string Request::toString() const
+{
+    std::string ret = "Request " + std::to_string((uint16_t)opcode);
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        ret += TRANSPORT_DELIM;
+        if (fields[i].type == FIELD_TYPE_INT)
+        {
+            ret += std::to_string(fields[i].integer);
+        }
+        else
+        {
+            ret += fields[i].text;
+        }
+    }
+    return ret;
+}
+
+Response::Response()
+{
+    status = Status::BadCommand;
+}
+
+void Response::addField(std::string_view field)
+{
+    fields.push_back({ FIELD_TYPE_TEXT, 0, field });
+    status = Status::Ok;
+}
+
+void Response::addField(int64_t field)
+{
+    fields.push_back({ FIELD_TYPE_INT, field, {} });
+    status = Status::Ok;
+}
+
+void Response::addOwnedField(std::string field)
+{
+    ownedFields.push_back(std::move(field));
+    addField(std::string_view(ownedFields.back()));
+}
+
+void Response::setStatus(Status status)
+{
+    this->status = status;
+}
+
+void Response::setOk()
+{
+    status = Status::Ok;
+}
+
+void Response::setId(std::optional<uint32_t> id)
+{
+    this->id = id;
+}
+
+void Response::reset()
+{
+    // keeps the capacity of fields, so a reused Response doesn't allocate
+    fields.clear();
+    ownedFields.clear();
+    status = Status::BadCommand;
+    id.reset();
+}
+
+void Response::appendText(std::string& out) const
+{
+    if (id)
+    {
+        char buffer[12];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), *id);
+        out += TRANSPORT_ID_PREFIX;
+        out.append(buffer, result.ptr);
+        out += TRANSPORT_DELIM;
+    }
+    out += statusToString(status);
+    out += TRANSPORT_DELIM;
+    for (auto& field : fields)
+    {
+        if (field.type == FIELD_TYPE_INT)
+        {
+            char buffer[24];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), field.integer);
+            out.append(buffer, result.ptr);
+        }
+        else
+        {
+            out += field.text;
+        }
+        out += TRANSPORT_DELIM;
+    }
+    out += '\n';
+}
+
+void Response::appendBinary(std::string& out) const
+{
+    // length is filled in once we know it
+    auto lengthOffset = out.size();
+    writeValue<uint32_t>(out, 0);
+
+    // rather than a count that wrapped, which would throw the client off for the rest of the connection
+    bool tooMany = fields.size() > TRANSPORT_MAX_RESPONSE_FIELDS;
+    size_t fieldCount = tooMany ? 0 : fields.size();
+    writeValue<uint16_t>(out, (uint16_t)(tooMany ? Status::BadCommand : status) | (id ? STATUS_FLAG_ID : 0));
+    writeValue<uint8_t>(out, (uint8_t)fieldCount);
+    if (id)
+    {
+        writeValue<uint32_t>(out, *id);
+    }
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        auto& field = fields[i];
+        if (field.type == FIELD_TYPE_INT && (field.integer < INT32_MIN || field.integer > INT32_MAX))
+        {
+            // counters and generations can outgrow 32 bits
+            writeValue<uint8_t>(out, FIELD_TYPE_INT64);
+            writeValue<int64_t>(out, field.integer);
+        }
+        else if (field.type == FIELD_TYPE_INT)
+        {
+            writeValue<uint8_t>(out, FIELD_TYPE_INT);
+            writeValue<int32_t>(out, (int32_t)field.integer);
+        }
+        else
+        {
+            writeValue<uint8_t>(out, field.type);
+            writeValue<uint32_t>(out, (uint32_t)field.text.size());
+            out += field.text;
+        }
+    }
+
+    uint32_t length = (uint32_t)(out.size() - lengthOffset - sizeof(uint32_t));
+    memcpy(&out[lengthOffset], &length, sizeof(length));
+}
+
+std::string Response::toString() const
+{
+    std::string ret;
+    appendText(ret);
+    return ret;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Transport version 1 is comma-delimited text: "SET,TEXT,hello" gets back "OK,\n".
+// Transport version 2 is length-prefixed binary (all values little-endian). Each frame is:
+//     uint32 length (of everything after this field)
+//     uint16 opcode (requests) or status (responses)
+//     uint8  field count
+//     fields, each: uint8 type, then an int32 (FIELD_TYPE_INT), an int64 (FIELD_TYPE_INT64) or a uint32 length followed
+//     by UTF-8 bytes (FIELD_TYPE_TEXT). Integers are sent as FIELD_TYPE_INT whenever they fit in 32 bits.
+// Requests are pipe messages, so a client write is always read as a whole, whatever its size or how many follow it.
+// A single write may contain many frames. Each frame gets a response frame, all sent back in a single write.
+// A command can name the TextInfo it applies to (a handle from NEW_TEXTINFO), instead of the current target:
+//     version 1: prefixed with "@<handle>," (like "@65536,SET,TEXT,hello")
+//     version 2: opcode | OPCODE_FLAG_TARGET, with a uint32 handle between the field count and the fields
+// A command can also carry a request id, which its response echoes, so a client can keep many in flight and match
+// the responses up (they still come back in order):
+//     version 1: prefixed with "#<id>," (before any target), and the response is too
+//     version 2: opcode | OPCODE_FLAG_ID, with a uint32 id right after the field count (before any target). The
+//                response's status has STATUS_FLAG_ID set, with the id in the same place.
+// After SUBSCRIBE, the connection only gets events: each is a response with the EVENT status (see EventQueue.h).
+// A client starts with version 1 and switches with SET,TRANSPORT_VERSION,2 (GET,TRANSPORT_VERSION gives current and max).
+#define TRANSPORT_VERSION_TEXT 1
+#define TRANSPORT_VERSION_BINARY 2
+#define TRANSPORT_VERSION_MAX TRANSPORT_VERSION_BINARY
+
+#define TRANSPORT_MAX_FIELDS 64
+// A version 2 frame counts its fields in a uint8, so no response can have more
+#define TRANSPORT_MAX_RESPONSE_FIELDS 255
+
+#define TRANSPORT_TARGET_PREFIX '@'
+#define OPCODE_FLAG_TARGET 0x8000
+
+#define TRANSPORT_ID_PREFIX '#'
+#define OPCODE_FLAG_ID 0x4000
+#define STATUS_FLAG_ID 0x8000
+
+enum class Opcode : uint16_t
+{
+    Invalid = 0x0000,
+
+    GetWidth = 0x0101,
+    GetHeight = 0x0102,
+    GetTextSize = 0x0103,
+    GetTextInfoCount = 0x0104,
+    GetTextInfoTarget = 0x0105,
+    GetRgb = 0x0106,
+    GetText = 0x0107,
+    GetXY = 0x0108,
+    GetTransportVersion = 0x0109,
+    GetStats = 0x010A,
+    GetAll = 0x010B,
+    GetInstance = 0x010C,
+
+    SetRgb = 0x0201,
+    SetText = 0x0202,
+    SetXY = 0x0203,
+    SetWinMsg = 0x0204,
+    SetTextInfoTarget = 0x0205,
+    SetLoggingEnabled = 0x0206,
+    SetTransportVersion = 0x0207,
+    SetMaxFps = 0x0208,
+    SetLogLevel = 0x0209,
+    SetSharedState = 0x020A,
+    SetTextRunCache = 0x020B,
+    SetRenderer = 0x020C,
+    SetGraph = 0x020D,
+    SetLayout = 0x020E,
+    SetAnimation = 0x020F,
+
+    NewTextInfo = 0x0301,
+    Paint = 0x0302,
+    Clear = 0x0303,
+    Stop = 0x0304,
+    SendWindowMessage = 0x0305,
+    DeleteTextInfo = 0x0306,
+    NewGraph = 0x0307,
+    DeleteGraph = 0x0308,
+    AppendGraph = 0x0309,
+    Subscribe = 0x030A,
+};
+
+enum class Status : uint16_t
+{
+    Ok = 0,
+    BadCommand = 1,
+    TextInfoTargetInvalid = 2,
+    MsgNotFound = 3,
+    GraphNotFound = 4,
+    Event = 5,
+};
+
+enum FieldType : uint8_t
+{
+    FIELD_TYPE_INT = 1,
+    FIELD_TYPE_TEXT = 2,
+    // only on the wire: once decoded, it's a FIELD_TYPE_INT like any other integer
+    FIELD_TYPE_INT64 = 3,
+};
+
+struct Field
+{
+    FieldType type;
+    int64_t integer;
+    std::string_view text;
+};
+
+class BadRequestException : public std::exception
+{
+    using std::exception::exception;
+};
+
+// A decoded request. Text fields point into the receive buffer, so a Request must not outlive it.
+class Request
+{
+public:
+    Request();
+
+    Opcode opcode;
+    // the TextInfo handle named by the command itself, if any
+    std::optional<uint32_t> target;
+    // for the response to echo, if the client gave one
+    std::optional<uint32_t> id;
+
+    size_t size() const;
+    bool addField(const Field& field);
+
+    // These throw BadRequestException if the field is missing or can't be read as the requested type.
+    int64_t getInt(size_t index) const;
+    std::string_view getText(size_t index) const;
+    // false for a FIELD_TYPE_INT field (or a missing one)
+    bool isText(size_t index) const;
+
+    std::string toString() const;
+
+private:
+    Field fields[TRANSPORT_MAX_FIELDS];
+    size_t fieldCount;
+};
+
+class Response
+{
+public:
+    Response();
+
+    // Text fields are not copied: they must stay valid until the response is encoded.
+    void addField(std::string_view field);
+    void addField(int64_t field);
+    // For text built just for the response, which is kept until reset()
+    void addOwnedField(std::string field);
+    void setStatus(Status status);
+    void setOk();
+    void setId(std::optional<uint32_t> id);
+    void reset();
+
+    // Appends the encoded response to out.
+    void appendText(std::string& out) const;
+    // A response with more than TRANSPORT_MAX_RESPONSE_FIELDS fields is sent as a BadCommand without any
+    void appendBinary(std::string& out) const;
+
+    std::string toString() const;
+private:
+    Status status;
+    std::optional<uint32_t> id;
+    std::vector<Field> fields;
+    // a deque, so growing it doesn't move the strings fields point into
+    std::deque<std::string> ownedFields;
+};
+
+// Splits s on delim into at most maxTokens views (without copying). Returns the number of tokens.
+size_t split(std::string_view s, char delim, std::string_view* tokens, size_t maxTokens);
+
+// Version 1: decodes a single comma-delimited command. Returns false if it isn't a known command, or has more than
+// TRANSPORT_MAX_FIELDS fields.
+bool parseTextRequest(std::string_view message, Request& request);
+
+// Version 2: decodes a single frame from the start of data. Returns the number of bytes consumed or 0 if malformed.
+size_t parseBinaryRequest(const char* data, size_t size, Request& request);
+
+// The version 1 keywords of opcode, joined by '_' (like "SET_TEXT")
+std::string opcodeToString(Opcode opcode);
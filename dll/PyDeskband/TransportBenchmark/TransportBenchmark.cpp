@@ -0,0 +1,120 @@
+// Times the transport's hot paths on their own, outside of a band: split() and parseTextRequest() for every v1
+// command, and Response::toString()/appendBinary() for every reply. Each case runs in batches and reports the
+// mean, p50 and p99 time per call of a batch, in nanoseconds. Build the TransportBenchmark project in Release, then:
+//     TransportBenchmark.exe [calls per case, 1000000 by default]
+// ControlPipe._benchmark() covers the rest (the pipe itself and painting), against a running band.
+
+#include "Transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#define BENCHMARK_BATCH_SIZE 1000
+#define BENCHMARK_DEFAULT_CALLS 1000000
+
+// So the compiler can't drop the calls whose results aren't otherwise used
+static volatile size_t sink;
+
+static void run(const char* name, size_t calls, const std::function<void()>& call)
+{
+    // a warm-up batch, so first-touch allocations aren't counted
+    for (size_t i = 0; i < BENCHMARK_BATCH_SIZE; i++)
+    {
+        call();
+    }
+
+    std::vector<double> samples;
+    size_t batches = std::max<size_t>(1, calls / BENCHMARK_BATCH_SIZE);
+    samples.reserve(batches);
+    double total = 0;
+    for (size_t batch = 0; batch < batches; batch++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < BENCHMARK_BATCH_SIZE; i++)
+        {
+            call();
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(elapsed / BENCHMARK_BATCH_SIZE);
+        total += elapsed;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    printf("%-38s mean %10.1f ns   p50 %10.1f ns   p99 %10.1f ns\n", name, total / (batches * BENCHMARK_BATCH_SIZE),
+        samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+}
+
+int main(int argc, char** argv)
+{
+    size_t calls = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCHMARK_DEFAULT_CALLS;
+
+    // what a client sends every tick, and the longest line a command can be
+    std::string shortCommand = "SET,TEXT,CPU: 12%";
+    std::string longCommand = "SET,LAYOUT";
+    for (int i = 0; i < TRANSPORT_MAX_FIELDS; i++)
+    {
+        longCommand += "," + std::to_string(i * 1000);
+    }
+
+    std::string_view tokens[TRANSPORT_MAX_FIELDS + 3];
+    run("split (3 tokens)", calls, [&]()
+    {
+        sink = split(shortCommand, ',', tokens, TRANSPORT_MAX_FIELDS + 3);
+    });
+    run("split (66 tokens)", calls, [&]()
+    {
+        sink = split(longCommand, ',', tokens, TRANSPORT_MAX_FIELDS + 3);
+    });
+    run("parseTextRequest (SET,TEXT)", calls, [&]()
+    {
+        Request request;
+        sink = parseTextRequest(shortCommand, request);
+    });
+
+    // the reply to a SET, and a full page of GET,ALL
+    Response small;
+    small.addField((int64_t)1);
+    Response large;
+    large.addField((int64_t)1);
+    large.addField((int64_t)0);
+    large.addField((int64_t)128);
+    for (int64_t i = 0; i < 128; i++)
+    {
+        large.addField(i + 65536);
+        large.addField(i * 40);
+        large.addField((int64_t)0);
+        large.addField((int64_t)255);
+        large.addField((int64_t)255);
+        large.addField((int64_t)255);
+        large.addField(std::string_view("CPU: 12%"));
+    }
+
+    run("Response::toString (1 field)", calls, [&]()
+    {
+        sink = small.toString().size();
+    });
+    // a page is about a hundred times the work of a small reply, so it gets a hundredth of the calls
+    run("Response::toString (GET,ALL page)", calls / 100, [&]()
+    {
+        sink = large.toString().size();
+    });
+    // how the pipe thread replies: into a buffer that's reused, so it only allocates while it grows
+    std::string out;
+    run("Response::appendText (GET,ALL page)", calls / 100, [&]()
+    {
+        out.clear();
+        large.appendText(out);
+        sink = out.size();
+    });
+    run("Response::appendBinary (GET,ALL page)", calls / 100, [&]()
+    {
+        out.clear();
+        large.appendBinary(out);
+        sink = out.size();
+    });
+
+    return 0;
+}
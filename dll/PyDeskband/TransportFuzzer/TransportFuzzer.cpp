@@ -0,0 +1,128 @@
+// libFuzzer target for the pipe transport. Transport.cpp has no explorer (or Windows) dependency, so this runs outside
+// of a band. Build the TransportFuzzer project, which the solution leaves out of its default build since it needs
+// MSVC's ASan and /fsanitize=fuzzer, or build it with clang-cl:
+//     clang-cl /std:c++17 /EHsc /Zi /fsanitize=fuzzer,address /I..\PyDeskband TransportFuzzer.cpp ..\PyDeskband\Transport.cpp
+// Then run it on a corpus directory, like "TransportFuzzer.exe corpus". Any crash, sanitizer report or abort() is a bug.
+
+#include "Transport.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Echoes what was parsed, the way a GET does, so the fields go back out through both encoders. Repeated, since a
+// reply can hold far more fields than a request (like a GET,ALL page).
+static void echo(const Request& request, Response& response, size_t repeats = 1)
+{
+    response.setId(request.id);
+    for (size_t i = 0; i < request.size() * repeats; i++)
+    {
+        if (request.isText(i % request.size()))
+        {
+            response.addField(request.getText(i % request.size()));
+        }
+        else
+        {
+            response.addField(request.getInt(i % request.size()));
+        }
+    }
+}
+
+// A binary response frame has the layout of a request frame, so parsing it back must give the same fields. One with
+// too many for the frame's count must be a BadCommand without any, never a count that wrapped.
+static void checkBinaryRoundTrip(const Request& request, size_t repeats, const Response& response)
+{
+    std::string out;
+    response.appendBinary(out);
+
+    // the header: uint32 length, uint16 status, uint8 field count
+    size_t fieldCount = request.size() * repeats;
+    bool tooMany = fieldCount > TRANSPORT_MAX_RESPONSE_FIELDS;
+    uint16_t status = 0;
+    memcpy(&status, &out[4], sizeof(status));
+    if ((uint8_t)out[6] != (tooMany ? 0 : fieldCount) || (tooMany && (status & ~STATUS_FLAG_ID) != (uint16_t)Status::BadCommand))
+    {
+        abort();
+    }
+    if (fieldCount > TRANSPORT_MAX_FIELDS && !tooMany)
+    {
+        // more than a Request can hold, so it can't be parsed back
+        return;
+    }
+
+    Request echoed;
+    if (parseBinaryRequest(out.data(), out.size(), echoed) != out.size() || echoed.size() != (tooMany ? 0 : fieldCount))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < echoed.size(); i++)
+    {
+        size_t field = i % request.size();
+        if (echoed.isText(i) != request.isText(field))
+        {
+            abort();
+        }
+        if (request.isText(field) ? echoed.getText(i) != request.getText(field) : echoed.getInt(i) != request.getInt(field))
+        {
+            abort();
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    auto chars = reinterpret_cast<const char*>(data);
+
+    // Version 1: the pipe splits batches into lines, but one line may still be anything
+    {
+        Request request;
+        Response response;
+        Response numbers;
+        if (parseTextRequest(std::string_view(chars, size), request))
+        {
+            echo(request, response);
+            // Commands read their numbers out of text fields, which may be anything
+            for (size_t i = 0; i < request.size(); i++)
+            {
+                try
+                {
+                    numbers.addField(request.getInt(i));
+                }
+                catch (BadRequestException)
+                {
+                }
+            }
+        }
+        std::string out;
+        response.appendText(out);
+        if (out.empty() || out.back() != '\n')
+        {
+            abort();
+        }
+        numbers.appendBinary(out);
+    }
+
+    // Version 2: every frame of the write, as ControlPipe::handleRequest walks them
+    size_t offset = 0;
+    while (offset < size)
+    {
+        Request request;
+        auto consumed = parseBinaryRequest(chars + offset, size - offset, request);
+        if (consumed == 0)
+        {
+            break;
+        }
+        if (consumed > size - offset)
+        {
+            abort();
+        }
+
+        // up to 8 times over, which is past TRANSPORT_MAX_RESPONSE_FIELDS for requests of more than 31 fields
+        size_t repeats = 1 + (uint16_t)request.opcode % 8;
+        Response response;
+        echo(request, response, repeats);
+        checkBinaryRoundTrip(request, repeats, response);
+        offset += consumed;
+    }
+
+    return 0;
+}
@@ -1,3 +1,3 @@
-from .pydeskband import ControlPipe
+from .pydeskband import ControlPipe, AsyncControlPipe
 
 __version__ = '0.0.1'
\ No newline at end of file
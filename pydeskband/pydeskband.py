@@ -1,20 +1,198 @@
+import asyncio
 import contextlib
 import enum
+import io
+import itertools
+import mmap
 import os
 import pathlib
+import random
+import struct
 import sys
 import time
 
 from dataclasses import dataclass
-from threading import Thread, Event
+from threading import Thread, Event, Lock
 from typing import Union, TypeVar
 
+# Transport version 2 (binary) opcodes and statuses. These must match Opcode/Status in Transport.h
+_OPCODES = {
+    ('GET', 'WIDTH'): 0x0101,
+    ('GET', 'HEIGHT'): 0x0102,
+    ('GET', 'TEXTSIZE'): 0x0103,
+    ('GET', 'TEXTINFOCOUNT'): 0x0104,
+    ('GET', 'TEXTINFO_TARGET'): 0x0105,
+    ('GET', 'RGB'): 0x0106,
+    ('GET', 'TEXT'): 0x0107,
+    ('GET', 'XY'): 0x0108,
+    ('GET', 'TRANSPORT_VERSION'): 0x0109,
+    ('GET', 'STATS'): 0x010A,
+    ('GET', 'ALL'): 0x010B,
+    ('GET', 'INSTANCE'): 0x010C,
+    ('SET', 'RGB'): 0x0201,
+    ('SET', 'TEXT'): 0x0202,
+    ('SET', 'XY'): 0x0203,
+    ('SET', 'WIN_MSG'): 0x0204,
+    ('SET', 'TEXTINFO_TARGET'): 0x0205,
+    ('SET', 'LOGGING_ENABLED'): 0x0206,
+    ('SET', 'TRANSPORT_VERSION'): 0x0207,
+    ('SET', 'MAX_FPS'): 0x0208,
+    ('SET', 'LOG_LEVEL'): 0x0209,
+    ('SET', 'SHARED_STATE'): 0x020A,
+    ('SET', 'TEXT_RUN_CACHE'): 0x020B,
+    ('SET', 'RENDERER'): 0x020C,
+    ('SET', 'GRAPH'): 0x020D,
+    ('SET', 'LAYOUT'): 0x020E,
+    ('SET', 'ANIMATION'): 0x020F,
+    ('NEW_TEXTINFO',): 0x0301,
+    ('PAINT',): 0x0302,
+    ('CLEAR',): 0x0303,
+    ('STOP',): 0x0304,
+    ('SENDMESSAGE',): 0x0305,
+    ('DELETE_TEXTINFO',): 0x0306,
+    ('NEW_GRAPH',): 0x0307,
+    ('DELETE_GRAPH',): 0x0308,
+    ('GRAPH_APPEND',): 0x0309,
+    ('SUBSCRIBE',): 0x030A,
+}
+# Set on an opcode when a TextInfo handle follows the field count
+_OPCODE_FLAG_TARGET = 0x8000
+# Set on an opcode (or status) when a request id follows the field count
+_OPCODE_FLAG_ID = 0x4000
+_STATUS_FLAG_ID = 0x8000
+_PIPE_PATH = '\\\\.\\pipe\\PyDeskbandControlPipe'
+# Must match BAND_MAX_INSTANCES in BandResources.h
+_MAX_INSTANCES = 16
+# Must match BATCH_MAX_COMMANDS in ControlPipe.cpp
+_BATCH_MAX_COMMANDS = 1024
+_STATUSES = {
+    0: 'OK',
+    1: 'BadCommand',
+    2: 'TextInfoTargetInvalid',
+    3: 'MSG_NOT_FOUND',
+    4: 'GRAPH_NOT_FOUND',
+    5: 'EVENT',
+}
+_FIELD_TYPE_INT = 1
+_FIELD_TYPE_TEXT = 2
+_FIELD_TYPE_INT64 = 3
+
+def _encode_binary_frame(cmd:list, target:Union[int, None]=None, request_id:Union[int, None]=None) -> bytes:
+    '''
+    Encodes a list of command keywords/fields (applied to the given TextInfo handle, if any) as a transport version 2 frame.
+    If request_id is given, the response echoes it.
+    '''
+    if cmd[0] in ('GET', 'SET'):
+        key, fields = tuple(cmd[:2]), cmd[2:]
+    else:
+        key, fields = tuple(cmd[:1]), cmd[1:]
+
+    opcode = _OPCODES.get(key)
+    if opcode is None:
+        raise ValueError(f"Unknown command: {cmd}")
+
+    if request_id is not None:
+        opcode |= _OPCODE_FLAG_ID
+    if target is not None:
+        opcode |= _OPCODE_FLAG_TARGET
+
+    body = struct.pack('<HB', opcode, len(fields))
+    if request_id is not None:
+        body += struct.pack('<I', request_id)
+    if target is not None:
+        body += struct.pack('<I', target)
+    for field in fields:
+        if isinstance(field, int) and -2 ** 31 <= field < 2 ** 31:
+            body += struct.pack('<Bi', _FIELD_TYPE_INT, field)
+        elif isinstance(field, int):
+            body += struct.pack('<Bq', _FIELD_TYPE_INT64, field)
+        else:
+            encoded = str(field).encode()
+            body += struct.pack('<BI', _FIELD_TYPE_TEXT, len(encoded)) + encoded
+
+    return struct.pack('<I', len(body)) + body
+
+def _decode_binary_frame(body:bytes) -> list:
+    ''' Decodes the body (everything after the length) of a transport version 2 response frame into a list of strings '''
+    return _decode_binary_frame_with_id(body)[1]
+
+def _decode_binary_frame_with_id(body:bytes) -> tuple:
+    ''' Like _decode_binary_frame(), but gives back (request id or None, list of strings) '''
+    status, field_count = struct.unpack_from('<HB', body)
+    offset = struct.calcsize('<HB')
+    request_id = None
+    if status & _STATUS_FLAG_ID:
+        request_id, = struct.unpack_from('<I', body, offset)
+        offset += 4
+        status &= ~_STATUS_FLAG_ID
+    response = [_STATUSES.get(status, 'BadCommand')]
+    for _ in range(field_count):
+        field_type, = struct.unpack_from('<B', body, offset)
+        offset += 1
+        if field_type == _FIELD_TYPE_INT:
+            value, = struct.unpack_from('<i', body, offset)
+            offset += 4
+            response.append(str(value))
+        elif field_type == _FIELD_TYPE_INT64:
+            value, = struct.unpack_from('<q', body, offset)
+            offset += 8
+            response.append(str(value))
+        else:
+            length, = struct.unpack_from('<I', body, offset)
+            offset += 4
+            response.append(body[offset:offset + length].decode())
+            offset += length
+
+    return request_id, response
+
+def _encode_command(cmd:Union[list, tuple, str, bytes], transport_version:int, target:Union[int, None]=None,
+                    request_id:Union[int, None]=None) -> bytes:
+    ''' Turns a command (applied to the given TextInfo handle, if any) into the bytes sent down the pipe in the given transport version '''
+    if isinstance(cmd, bytes):
+        # already encoded
+        return cmd
+
+    if isinstance(cmd, str):
+        cmd = cmd.split(',')
+
+    if transport_version == 2:
+        return _encode_binary_frame(list(cmd), target, request_id)
+
+    prefix = []
+    if request_id is not None:
+        prefix.append(f'#{request_id}')
+    if target is not None:
+        prefix.append(f'@{target}')
+    return ','.join([str(c) for c in prefix + list(cmd)]).encode()
+
+def _decode_text_response(line:bytes) -> tuple:
+    ''' Splits a transport version 1 response line into (request id or None, list of strings) '''
+    response = line.strip().decode().split(',')
+    if response[0].startswith('#'):
+        return int(response[0][1:]), response[1:]
+    return None, response
+
+def _instance_name(name:str, instance:int) -> str:
+    ''' Like instanceName() in BandResources.cpp: the first band keeps the plain name, the others get name.<instance> '''
+    return name if instance == 0 else f'{name}.{instance}'
+
 @dataclass
 class Size:
     ''' A Python-version of the SIZE struct in WinApi '''
     x: int
     y: int
 
+@dataclass
+class InstanceInfo:
+    ''' Which band a ControlPipe is connected to, from ControlPipe.get_instance() '''
+    instance: int
+    dpi: int
+    # the band's window on screen, which tells the taskbar it's on
+    left: int
+    top: int
+    right: int
+    bottom: int
+
 @dataclass
 class Color:
     ''' Representation of an RGB color '''
@@ -50,14 +228,30 @@ class _LogTailer(Thread):
 
 class ControlPipe:
     ''' The mechanism for controlling PyDeskband.'''
-    def __init__(self):
-        ''' Note that this may raise if PyDeskband is not in use '''
+    def __init__(self, transport_version:int=1, instance:int=0):
+        '''
+        Note that this may raise if PyDeskband is not in use.
+
+        Transport version 1 is comma-delimited text. Version 2 is binary and allows any character in text.
+        With a band on several taskbars, each is its own instance (see list_instances()). 0 is the first one.
+        '''
+        self._instance = instance
         try:
-            self.pipe = open('\\\\.\\pipe\\PyDeskbandControlPipe', 'r+b', buffering=0)
+            self.pipe = open(_instance_name(_PIPE_PATH, instance), 'r+b', buffering=0)
         except FileNotFoundError as ex:
             raise FileNotFoundError(f"The PyDeskbandControlPipe is not available. Is the deskband enabled?.. {str(ex)}")
+        # Every write is one pipe message, so it goes straight to the pipe. Reads are buffered: the unbuffered
+        # readline() would take a ReadFile per byte.
+        self._reader = io.BufferedReader(self.pipe)
         self._log_tailer = None
 
+        # When not None, we are within batch() and commands get queued here instead of sent.
+        self._batch_commands = None
+
+        self._transport_version = 1
+        if transport_version != 1:
+            self.set_transport_version(transport_version)
+
     def __enter__(self):
         ''' For use as a contextmanager '''
         return self
@@ -66,30 +260,111 @@ class ControlPipe:
         ''' For use as a contextmanager... Closes the handle to the pipe '''
         self.pipe.close()
 
-    def send_command(self, cmd:Union[list, tuple, str], check_ok:bool=True) -> list:
+    def send_command(self, cmd:Union[list, tuple, str], check_ok:bool=True, target:Union[int, None]=None) -> list:
         '''
         The main entry point to go from Python to/from the C++ code. It is very unlikely that a regular user
         would want to call this directly. If something is done incorrectly here, PyDeskband will likely crash...
             and that will lead to Windows Explorer restarting.
 
+        If called within batch(), the command is queued (and an empty list is returned) instead.
+
         Arguments:
             cmd: Either a list of command keywords or a string of a full command
             check_ok: If True, raise ValueError if C++ does not give back "OK" as the return status.
                 If set, will remove OK from the return list.
+            target: The handle of the TextInfo the command applies to. If None, the current TextInfo target is used.
 
         Returns:
             A list of return fields.
         '''
-        if isinstance(cmd, (list, tuple)):
-            cmd = ','.join([str(c) for c in cmd])
+        cmd = self._encode_command(cmd, target)
+
+        if self._batch_commands is not None:
+            self._batch_commands.append(cmd)
+            return []
+
+        self._write(cmd)
+        return self._read_response(check_ok)
+
+    def send_batch(self, cmds:list, check_ok:bool=True) -> list:
+        '''
+        Sends all of the given commands in a single BATCH frame. The DLL applies them together (without painting in between)
+        and replies to all of them in one go. More than the DLL takes in one batch (_BATCH_MAX_COMMANDS) are sent as
+        several, each applied on its own.
+
+        Arguments:
+            cmds: A list of commands. Each follows the same format as the cmd given to send_command()
+            check_ok: If True, raise ValueError if any command does not give back "OK" as the return status.
+                If set, will remove OK from each return list.
 
-        cmd = cmd.encode()
+        Returns:
+            A list (one entry per command) of lists of return fields.
+        '''
+        if self._batch_commands is not None:
+            raise RuntimeError("send_batch() cannot be called from within batch()")
+
+        cmds = [self._encode_command(c) for c in cmds]
+        if not cmds:
+            return []
+
+        responses = []
+        for start in range(0, len(cmds), _BATCH_MAX_COMMANDS):
+            chunk = cmds[start:start + _BATCH_MAX_COMMANDS]
+            if self._transport_version == 2:
+                # In version 2 every frame in a single write is part of the batch
+                self._write(b''.join(chunk))
+            else:
+                self._write(b'\n'.join([b'BATCH'] + chunk))
+            responses += [self._read_response(check_ok) for _ in chunk]
+        return responses
 
+    @contextlib.contextmanager
+    def batch(self):
+        '''
+        Within this context, commands that don't need a return value (setters, paint, etc.) are queued instead of sent.
+        On exit, everything queued is sent as a single BATCH frame.
+
+        Getters (anything that reads a value back) cannot be used within a batch.
+        '''
+        if self._batch_commands is not None:
+            # Nested: the outermost batch() sends everything.
+            yield
+            return
+
+        self._batch_commands = []
+        try:
+            yield
+            cmds = self._batch_commands
+        finally:
+            self._batch_commands = None
+
+        self.send_batch(cmds)
+
+    @property
+    def in_batch(self) -> bool:
+        ''' True if within batch() '''
+        return self._batch_commands is not None
+
+    def _encode_command(self, cmd:Union[list, tuple, str, bytes], target:Union[int, None]=None) -> bytes:
+        '''
+        Helper function. Turns a command (applied to the given TextInfo handle, if any) into the bytes sent down the pipe
+        for the current transport version
+        '''
+        return _encode_command(cmd, self._transport_version, target)
+
+    def _write(self, cmd:bytes) -> None:
+        ''' Helper function. Writes an already encoded command (or frame) down the pipe '''
         bytes_written = self.pipe.write(cmd)
         if bytes_written != len(cmd):
             raise RuntimeError(f"Unable to write all the bytes down the pipe. Wrote: {bytes_written} instead of {len(cmd)}")
 
-        response = self.pipe.readline().strip().decode().split(',')
+    def _read_response(self, check_ok:bool=True) -> list:
+        ''' Helper function. Reads a single response (line or frame) from the pipe and splits it into fields '''
+        if self._transport_version == 2:
+            length, = struct.unpack('<I', self._read_exactly(4))
+            response = _decode_binary_frame(self._read_exactly(length))
+        else:
+            response = self._reader.readline().strip().decode().split(',')
 
         if not response:
             raise ValueError("Response was empty.")
@@ -101,6 +376,16 @@ class ControlPipe:
 
         return response
 
+    def _read_exactly(self, size:int) -> bytes:
+        ''' Helper function. Reads exactly size bytes from the pipe '''
+        data = b''
+        while len(data) < size:
+            chunk = self._reader.read(size - len(data))
+            if not chunk:
+                raise EOFError("The PyDeskbandControlPipe was closed")
+            data += chunk
+        return data
+
     def get_width(self) -> int:
         ''' Get the current width (in pixels) of the deskband '''
         return int(self.send_command(['GET', 'WIDTH'])[0])
@@ -113,14 +398,87 @@ class ControlPipe:
         ''' Get the count of TextInfos currently saved '''
         return int(self.send_command(['GET', 'TEXTINFOCOUNT'])[0])
 
+    @staticmethod
+    def list_instances() -> list:
+        ''' The instances of the band that can be connected to, one per taskbar it's on '''
+        pipes = set(os.listdir('\\\\.\\pipe\\'))
+        name = _PIPE_PATH.rsplit('\\', 1)[-1]
+        return [i for i in range(_MAX_INSTANCES) if _instance_name(name, i) in pipes]
+
+    def get_instance(self) -> InstanceInfo:
+        ''' Which band this is connected to: its instance, DPI and where it is on screen '''
+        return InstanceInfo(*[int(f) for f in self.send_command(['GET', 'INSTANCE'])[:6]])
+
+    def get_stats(self, reset:bool=False) -> dict:
+        '''
+        Gets the DLL's performance counters as a dict of name -> int. Latencies are in microseconds and include
+        count, mean, p50, p99 and max, like request_us_p99. If reset is True, every counter starts over afterwards.
+        '''
+        if self.in_batch:
+            raise RuntimeError("get_stats() cannot be called from within batch()")
+
+        fields = self.send_command(['GET', 'STATS', 1 if reset else 0])
+
+        # name, value pairs (ignoring the trailing empty field of a text response)
+        return {str(fields[i]): int(fields[i + 1]) for i in range(0, len(fields) - 1, 2)}
+
+    def get_all(self, known_generation:Union[int, None]=None) -> Union[tuple, None]:
+        '''
+        Reads back every TextInfo in as few round trips as possible. Returns (generation, [TextInfoState, ...]).
+
+        If known_generation is a generation returned earlier and nothing has changed since, returns None instead
+        (without downloading anything).
+        '''
+        if self.in_batch:
+            raise RuntimeError("get_all() cannot be called from within batch()")
+
+        while True:
+            generation = None
+            states = []
+            cursor = 0
+            while True:
+                cmd = ['GET', 'ALL', known_generation if known_generation is not None else -1, cursor]
+                fields = self.send_command(cmd)
+                chunk_generation, cursor, count = int(fields[0]), int(fields[1]), int(fields[2])
+                if chunk_generation == known_generation:
+                    return None
+                if generation is None:
+                    generation = chunk_generation
+                elif generation != chunk_generation:
+                    # changed while reading it: start over
+                    break
+
+                for i in range(3, 3 + count * 7, 7):
+                    handle, x, y, red, green, blue = (int(f) for f in fields[i:i + 6])
+                    states.append(TextInfoState(TextInfo(self, handle), str(fields[i + 6]), x, y, Color(red, green, blue)))
+
+                if cursor == 0:
+                    return generation, states
+
     def add_new_text_info(self, text:str, x:int=0, y:int=0, red:int=255, green:int=255, blue:int=255) -> None:
-        ''' Creates a new TextInfo with the given text,x/y, and rgb text color '''
-        self.send_command('NEW_TEXTINFO')
-        self._set_color(red, green, blue)
-        self._set_coordinates(x, y)
-        self._set_text(text)
-        idx = (self.get_text_info_count() - 1)
-        return TextInfo(self, idx)
+        ''' Creates a new TextInfo with the given text,x/y, and rgb text color. Cannot be called from within batch(). '''
+        self._verify_coordinates(x, y)
+        text = self._verify_input_text(text)
+
+        handle = int(self.send_command('NEW_TEXTINFO')[0])
+        self.send_batch([self._encode_command(cmd, handle) for cmd in (
+            ['SET', 'RGB', red, green, blue],
+            ['SET', 'XY', x, y],
+            ['SET', 'TEXT', text],
+        )])
+        return TextInfo(self, handle)
+
+    def add_new_graph(self, capacity:int, x:int, y:int, width:int, height:int, minimum:int=0, maximum:int=100,
+                      red:int=255, green:int=255, blue:int=255, style:'GraphStyle'=None) -> 'Graph':
+        '''
+        Creates a new Graph that keeps the last capacity samples and draws them in the given rect.
+        Cannot be called from within batch().
+        '''
+        self._verify_coordinates(x, y)
+        handle = int(self.send_command(['NEW_GRAPH', capacity])[0])
+        graph = Graph(self, handle)
+        graph.set(x, y, width, height, minimum, maximum, red, green, blue, style or GraphStyle.LINE)
+        return graph
 
     def get_text_size(self, text:str) -> Size:
         ''' Gets a Size object corresponding with the x,y size this text would be (likely in pixels) '''
@@ -164,6 +522,15 @@ class ControlPipe:
         else:
             _stop_log_tailer()
 
+    def set_log_level(self, level:'LogLevel') -> None:
+        '''
+        Sets how much the C++ module logs (once logging is enabled via set_logging). The default is LogLevel.INFO.
+        LogLevel.VERBOSE also logs every request, response and paint, which is a lot.
+        '''
+        self.send_command([
+            'SET', 'LOG_LEVEL', int(level)
+        ])
+
     def get_transport_version(self) -> int:
         '''
         Gets the current transport version from the DLL.
@@ -172,17 +539,107 @@ class ControlPipe:
             'GET', 'TRANSPORT_VERSION'
         ])[0])
 
-    def set_windows_message_handle_shell_cmd(self, msg_id:int, shell_cmd:str=None) -> None:
-        ''' Tell PyDeskband that if msg_id is sent to the form, run this shell command. If shell_cmd is None, clear existing handling of the msg_id. '''
+    def get_max_transport_version(self) -> int:
+        '''
+        Gets the newest transport version the DLL supports. Older DLLs only know version 1.
+        '''
+        fields = self.send_command([
+            'GET', 'TRANSPORT_VERSION'
+        ])
+        if len(fields) > 1 and fields[1]:
+            return int(fields[1])
+        return 1
+
+    def set_transport_version(self, version:int) -> None:
+        '''
+        Switches this connection to the given transport version. Raises if the DLL doesn't support it.
+        '''
+        if self.in_batch:
+            raise RuntimeError("The transport version cannot be changed from within batch()")
+
+        if version != 1 and version > self.get_max_transport_version():
+            raise ValueError(f"The DLL does not support transport version: {version}")
+
+        # The DLL replies to this in the old version
+        self.send_command([
+            'SET', 'TRANSPORT_VERSION', version
+        ])
+        self._transport_version = version
+
+    def set_max_fps(self, fps:int) -> None:
+        '''
+        Limits how often the deskband repaints. Any number of paint() calls within a frame are merged into one repaint.
+        0 means unlimited. The default is 60.
+        '''
+        if fps < 0:
+            raise ValueError("fps must not be negative")
+
+        self.send_command([
+            'SET', 'MAX_FPS', fps
+        ])
+
+    def set_text_run_cache(self, entries:int) -> None:
+        '''
+        Sets how many drawn pieces of text (per text, color and size) the deskband keeps to redraw from, instead of
+        drawing them from scratch. 0 turns this off. The default is 256.
+        '''
+        if entries < 0:
+            raise ValueError("entries must not be negative")
+
+        self.send_command([
+            'SET', 'TEXT_RUN_CACHE', entries
+        ])
+
+    def set_renderer(self, renderer:'Renderer') -> None:
+        '''
+        Picks what the deskband draws with. Renderer.DIRECT2D falls back to Renderer.GDI if Direct2D isn't available.
+        Either way, plain GDI is used while composition is off.
+        '''
+        self.send_command([
+            'SET', 'RENDERER', int(renderer)
+        ])
+
+    def enable_shared_state(self) -> 'SharedState':
+        '''
+        Turns on the shared memory slots and returns a SharedState to write them with.
+        Writing a slot doesn't go through the pipe at all: the band picks it up on its next repaint tick.
+        '''
+        self.send_command([
+            'SET', 'SHARED_STATE', 1
+        ])
+        return SharedState(self._instance)
+
+    def disable_shared_state(self) -> None:
+        ''' Turns off the shared memory slots. Whatever they showed is removed from the deskband. '''
+        self.send_command([
+            'SET', 'SHARED_STATE', 0
+        ])
+
+    def set_windows_message_handle_shell_cmd(self, msg_id:int, shell_cmd:str=None, debounce_ms:int=0) -> None:
+        '''
+        Tell PyDeskband that if msg_id is sent to the form, run this shell command. If shell_cmd is None, clear existing handling of the msg_id.
+        The command runs in the background (so it doesn't block the taskbar). If debounce_ms is given, msg_id arriving again within that many
+        milliseconds of the last time it ran the command is ignored.
+        '''
         if shell_cmd is not None:
+            if debounce_ms < 0:
+                raise ValueError("debounce_ms must not be negative")
+
             return self.send_command([
-                'SET', 'WIN_MSG', msg_id, self._verify_input_text(shell_cmd)
+                'SET', 'WIN_MSG', msg_id, self._verify_input_text(shell_cmd), debounce_ms
             ])
         else:
             return self.send_command([
                 'SET', 'WIN_MSG', msg_id
             ])
 
+    def subscribe(self, events:'Event', messages:tuple=()) -> 'EventSubscription':
+        '''
+        Opens another connection, which the DLL pushes the given events down as they happen (instead of polling for them).
+        messages are the window message ids reported by Event.WIN_MSG.
+        '''
+        return EventSubscription(events, messages, self._transport_version, self._instance)
+
     def _send_message(self, msg:int) -> None:
         ''' Likely only useful for debugging. Send a WM_... message with the given id to our hwnd.'''
         self.send_command([
@@ -190,55 +647,98 @@ class ControlPipe:
         ])
 
     def _verify_input_text(self, text) -> str:
-        ''' Helper function. Verifies that the delimiter is not in the given text. Returns the text if not found. Otherwise raises. '''
+        ''' Helper function. Verifies that the delimiters are not in the given text. Returns the text if not found. Otherwise raises. '''
+        if self._transport_version == 2:
+            # binary fields are length-prefixed so any character is fine
+            return text
+
         if ',' in text:
             raise ValueError(f"text cannot contain a ',' sign. Text: {text}")
+        if '\n' in text:
+            raise ValueError(f"text cannot contain a newline. Text: {text}")
         return text
 
-    def _set_text(self, text:str) -> str:
+    def _verify_coordinates(self, x:int, y:int) -> None:
+        ''' Helper function. Raises if the given coordinates are negative '''
+        if x < 0:
+            raise ValueError(f"x cannot be less than 0. It was set to: {x}")
+        if y < 0:
+            raise ValueError(f"y cannot be less than 0. It was set to: {y}")
+
+    def _set_text(self, text:str, target:Union[int, None]=None) -> str:
         ''' Call to SET TEXT in the DLL '''
         return self.send_command([
             'SET', 'TEXT', self._verify_input_text(text)
-        ])
+        ], target=target)
 
-    def _set_color(self, red:int=255, green:int=255, blue:int=255) -> str:
+    def _set_color(self, red:int=255, green:int=255, blue:int=255, target:Union[int, None]=None) -> str:
         ''' Call to SET RGB in the DLL '''
         return self.send_command([
             'SET', 'RGB', red, green, blue
-        ])
+        ], target=target)
 
-    def _set_coordinates(self, x:int=0, y:int=0) -> str:
+    def _set_coordinates(self, x:int=0, y:int=0, target:Union[int, None]=None) -> str:
         ''' Call to SET XY in the DLL '''
-        if x < 0:
-            raise ValueError(f"x cannot be less than 0. It was set to: {x}")
-        if y < 0:
-            raise ValueError(f"y cannot be less than 0. It was set to: {y}")
+        self._verify_coordinates(x, y)
 
         return self.send_command([
             'SET', 'XY', x, y
-        ])
+        ], target=target)
 
     def _set_textinfo_target(self, idx:Union[int, None]=None) -> str:
         ''' Call to SET TEXTINFO_TARGET in the DLL. Passing an index of None will lead to the last TextInfo being targeted '''
+        return self.send_command(self._textinfo_target_command(idx))
+
+    def _textinfo_target_command(self, idx:Union[int, None]=None) -> list:
+        ''' Helper function. Builds the SET TEXTINFO_TARGET command for the given index (or None) '''
         if idx is None:
-            return self.send_command(["SET", "TEXTINFO_TARGET"])
+            return ["SET", "TEXTINFO_TARGET"]
         else:
-            return self.send_command(["SET", "TEXTINFO_TARGET", str(idx)])
+            return ["SET", "TEXTINFO_TARGET", str(idx)]
 
-    def _get_text(self) -> str:
+    # Without a target, the GETs below read the current TextInfo. A band without any raises ValueError
+    # (TextInfoTargetInvalid) for them: older DLLs made an empty TextInfo to read from instead. Only the SETs of a
+    # TextInfo's text, color, coordinates, layout or animations still make one.
+    def _get_text(self, target:Union[int, None]=None) -> str:
         ''' Call to GET TEXT in the DLL '''
-        return self.send_command(["GET", "TEXT"])[0]
+        return self.send_command(["GET", "TEXT"], target=target)[0]
 
-    def _get_color(self) -> Color:
+    def _get_color(self, target:Union[int, None]=None) -> Color:
         ''' Call to GET RGB in the DLL '''
-        r, g, b = self.send_command(["GET", "RGB"])[:3]
+        r, g, b = self.send_command(["GET", "RGB"], target=target)[:3]
         return Color(int(r), int(g), int(b))
 
-    def _get_coordinates(self) -> Size:
+    def _get_coordinates(self, target:Union[int, None]=None) -> Size:
         ''' Call to GET XY in the DLL '''
-        x, y = self.send_command(["GET", "XY"])[:2]
+        x, y = self.send_command(["GET", "XY"], target=target)[:2]
         return Size(int(x), int(y))
 
+    def _set_layout(self, x_percent:int, y_percent:int, x_offset:int, y_offset:int, horizontal:'Align', vertical:'Align',
+                    after:Union[int, None]=None, flow:'Flow'=None, gap:int=0, target:Union[int, None]=None) -> str:
+        ''' Call to SET LAYOUT in the DLL '''
+        cmd = ['SET', 'LAYOUT', x_percent, y_percent, x_offset, y_offset, int(horizontal), int(vertical)]
+        if after is not None:
+            cmd += [after, int(flow if flow is not None else Flow.RIGHT), gap]
+        return self.send_command(cmd, target=target)
+
+    def _clear_layout(self, target:Union[int, None]=None) -> str:
+        ''' Call to SET LAYOUT (without a layout) in the DLL '''
+        return self.send_command(['SET', 'LAYOUT'], target=target)
+
+    def _set_animation(self, prop:'_AnimatedProperty', duration_ms:int, easing:'Easing', values:list, target:Union[int, None]=None) -> str:
+        ''' Call to SET ANIMATION in the DLL '''
+        if duration_ms < 0:
+            raise ValueError(f"duration_ms must not be negative. It was: {duration_ms}")
+        return self.send_command(['SET', 'ANIMATION', int(prop), int(duration_ms), int(easing)] + list(values), target=target)
+
+    def _clear_animations(self, target:Union[int, None]=None) -> str:
+        ''' Call to SET ANIMATION (without an animation) in the DLL '''
+        return self.send_command(['SET', 'ANIMATION'], target=target)
+
+    def _delete_text_info(self, target:int) -> str:
+        ''' Call to DELETE_TEXTINFO in the DLL '''
+        return self.send_command(["DELETE_TEXTINFO", target])
+
     def _get_textinfo_target(self) -> Union[int, None]:
         ''' Call to GET TEXTINFO_TARGET in the DLL. A return of None, means that the current target is the last TextInfo.'''
         # Cheap use of eval. It can be 'None' or an int.
@@ -299,60 +799,536 @@ class ControlPipe:
             self.paint()
             time.sleep(sleep_time)
 
+    def _benchmark(self, iterations:int=10000, textinfo_counts:tuple=(1, 10, 100, 500), paints_per_count:int=50) -> dict:
+        '''
+        A load test for the pipe and the renderer. Clears the deskband! Prints and returns a dict of results.
+            Round trips: commands/sec and p50/p99 latency (microseconds) of a single command and of batches
+            Paints: DLL-side paint time (from get_stats) against the number of TextInfos
+        The TransportBenchmark project times the DLL's parsing and replies on their own.
+        '''
+        import statistics
+
+        def percentile(samples, percent):
+            samples = sorted(samples)
+            return samples[min(len(samples) - 1, int(len(samples) * percent / 100))]
+
+        def measure_round_trips(name, send, commands_per_send):
+            samples = []
+            start = time.perf_counter()
+            for _ in range(iterations):
+                before = time.perf_counter()
+                send()
+                samples.append((time.perf_counter() - before) * 1000000)
+            elapsed = time.perf_counter() - start
+
+            results[name] = {
+                'commands_per_sec': int(iterations * commands_per_send / elapsed),
+                'p50_us': int(percentile(samples, 50)),
+                'p99_us': int(percentile(samples, 99)),
+                'mean_us': int(statistics.mean(samples)),
+            }
+
+        results = {}
+        self.clear()
+        self.get_stats(reset=True)
+
+        measure_round_trips('round_trip', lambda: self.send_command(['GET', 'WIDTH']), 1)
+        batch = [['GET', 'WIDTH']] * 100
+        measure_round_trips('round_trip_batch_100', lambda: self.send_batch(batch), len(batch))
+
+        stats = self.get_stats(reset=True)
+        results['dll_request_us'] = {k: v for k, v in stats.items() if k.startswith('request_us')}
+
+        for count in textinfo_counts:
+            self.clear()
+
+            # add_new_text_info() can't be batched. With no target set, these apply to the newest TextInfo.
+            commands = []
+            for i in range(count):
+                commands += ['NEW_TEXTINFO', ['SET', 'XY', (i * 20) % 200, (i // 10) % 30], ['SET', 'TEXT', f'{i}']]
+            self.send_batch(commands + ['PAINT'])
+            time.sleep(.1)
+            self.get_stats(reset=True)
+
+            # Every TextInfo changes every time, so each paint redraws all of them
+            for paint in range(paints_per_count):
+                commands = []
+                for i in range(count):
+                    commands += [self._textinfo_target_command(i), ['SET', 'TEXT', f'{(i + paint) % 1000}']]
+                # send_batch() splits this at _BATCH_MAX_COMMANDS, and the target carries over from one part to the next
+                self.send_batch(commands + [self._textinfo_target_command(None), 'PAINT'])
+                # lets the repaint scheduler get to it
+                time.sleep(1 / 30)
+
+            stats = self.get_stats(reset=True)
+            results[f'paint_{count}_textinfos'] = {k: v for k, v in stats.items() if k.startswith(('paint', 'draw_text'))}
+
+        self.clear()
+
+        for name, result in results.items():
+            print(f'{name}: {result}')
+        return results
+
+    def _stress(self, threads:int=4, seconds:float=10.0, textinfos_per_thread:int=8) -> dict:
+        '''
+        A concurrency test for the pipe and the paint path. Clears the deskband! Prints and returns a dict of results.
+        Each thread gets its own connection (alternating transport versions) and TextInfos, and keeps setting their
+        text, color and position, painting and reading them back, while this connection reads everything with get_all().
+        Any TextInfo that doesn't read back as its thread last set it, or a connection that breaks, is counted.
+        '''
+        self.clear()
+        stop_at = time.perf_counter() + seconds
+        counts = {'commands': 0, 'mismatches': 0, 'errors': 0, 'snapshots': 0}
+        lock = Lock()
+
+        def worker(index):
+            commands = mismatches = 0
+            try:
+                with ControlPipe(transport_version=1 + index % 2, instance=self._instance) as pipe:
+                    handles = [int(pipe.send_command('NEW_TEXTINFO')[0]) for _ in range(textinfos_per_thread)]
+                    iteration = 0
+                    while time.perf_counter() < stop_at:
+                        texts = {}
+                        batch = []
+                        for i, handle in enumerate(handles):
+                            texts[handle] = f'{index}-{iteration}-{i}'
+                            batch += [pipe._encode_command(['SET', 'TEXT', texts[handle]], handle),
+                                      pipe._encode_command(['SET', 'RGB', iteration % 256, index % 256, i % 256], handle),
+                                      pipe._encode_command(['SET', 'XY', (i * 20) % 200, index % 30], handle)]
+                        pipe.send_batch(batch + ['PAINT'])
+                        commands += len(batch) + 1
+
+                        for handle in handles:
+                            if pipe._get_text(target=handle) != texts[handle]:
+                                mismatches += 1
+                        commands += len(handles)
+                        iteration += 1
+            except Exception:
+                with lock:
+                    counts['errors'] += 1
+            with lock:
+                counts['commands'] += commands
+                counts['mismatches'] += mismatches
+
+        workers = [Thread(target=worker, args=(i,), daemon=True) for i in range(threads)]
+        start = time.perf_counter()
+        for w in workers:
+            w.start()
+
+        # the UI thread paints from snapshots while the pipe thread edits: these must always be whole
+        while any(w.is_alive() for w in workers):
+            self.get_all()
+            counts['snapshots'] += 1
+        elapsed = time.perf_counter() - start
+
+        results = dict(counts)
+        results['commands_per_sec'] = int(counts['commands'] / elapsed)
+        results['alive'] = self.get_width() >= 0
+        self.clear()
+
+        for name, result in results.items():
+            print(f'{name}: {result}')
+        return results
+
+    def _test_get_all(self, count:int=100) -> dict:
+        '''
+        Checks that get_all() reads back every one of count TextInfos, in each transport version the DLL supports. Far
+        more than fit in one GET,ALL page (or in one version 2 frame, at 255 fields), so it takes several. The
+        connection must still be in step afterwards. Clears the deskband! Prints and returns a dict of results.
+        '''
+        self.clear()
+        handles = [int(fields[0]) for fields in self.send_batch(['NEW_TEXTINFO'] * count)]
+        expected = {}
+        batch = []
+        for i, handle in enumerate(handles):
+            expected[handle] = (f'textinfo {i}', i % 200, i % 30, Color(i % 256, (i * 7) % 256, (i * 13) % 256))
+            text, x, y, color = expected[handle]
+            batch += [self._encode_command(['SET', 'TEXT', text], handle),
+                      self._encode_command(['SET', 'RGB', color.red, color.green, color.blue], handle),
+                      self._encode_command(['SET', 'XY', x, y], handle)]
+        self.send_batch(batch)
+
+        original_version = self._transport_version
+        results = {}
+        for version in range(1, self.get_max_transport_version() + 1):
+            self.set_transport_version(version)
+            _, states = self.get_all()
+            read = {s.text_info._handle: (s.text, s.x, s.y, s.color) for s in states}
+            results[f'v{version}_matches'] = read == expected
+            # a misread frame would throw off whatever comes next
+            results[f'v{version}_in_step'] = self.get_text_info_count() == count
+        self.set_transport_version(original_version)
+        self.clear()
+
+        for name, result in results.items():
+            print(f'{name}: {result}')
+        return results
+
+    def _fuzz(self, iterations:int=10000, seed:Union[int, None]=None) -> dict:
+        '''
+        Throws malformed requests at the DLL: mangled commands, random bytes and truncated or bit-flipped binary frames,
+        on a connection of their own. The DLL must answer (or drop the connection) and keep serving this one, which is
+        checked after every request. Commands that could run anything or stop the band are never sent. Clears the
+        deskband! Prints and returns a dict of results, including the seed to reproduce them with.
+
+        The parsers themselves are better fuzzed natively, by the TransportFuzzer project. This covers what that can't:
+        dispatching to a live band.
+        '''
+        seed = seed if seed is not None else random.randrange(2 ** 32)
+        rng = random.Random(seed)
+
+        # the commands whose effects reach outside the band (or end it, or make the connection stop answering)
+        forbidden = {('SET', 'WIN_MSG'), ('STOP',), ('SENDMESSAGE',), ('SUBSCRIBE',), ('SET', 'TRANSPORT_VERSION')}
+        forbidden_words = [b'WIN_MSG', b'STOP', b'SENDMESSAGE', b'SUBSCRIBE', b'TRANSPORT_VERSION']
+        forbidden_opcodes = {_OPCODES[key] for key in forbidden}
+        allowed = [key for key in _OPCODES if key not in forbidden]
+
+        def random_field():
+            choice = rng.randrange(4)
+            if choice == 0:
+                return rng.randrange(-2 ** 31, 2 ** 31)
+            elif choice == 1:
+                return rng.choice([0, 1, -1, 255, 65536, 2 ** 31 - 1])
+            elif choice == 2:
+                # anything but surrogates, which can't be encoded
+                codepoints = [rng.randrange(32, 0x2FFFF) for _ in range(rng.randrange(16))]
+                return ''.join(chr(c) for c in codepoints if not 0xD800 <= c <= 0xDFFF)
+            return 'x' * rng.randrange(4096)
+
+        def text_message():
+            if rng.randrange(4) == 0:
+                return bytes(rng.randrange(256) for _ in range(rng.randrange(1, 256)))
+            key = rng.choice(allowed)
+            prefix = rng.choice(['', f'@{rng.randrange(2 ** 32)},', f'#{rng.randrange(2 ** 32)},', '@', '#x,'])
+            fields = [str(random_field()) for _ in range(rng.randrange(8))]
+            message = (prefix + ','.join(list(key) + fields)).encode('utf-8', 'replace')
+            if rng.randrange(2):
+                message = b'BATCH\n' + b'\n'.join([message] * rng.randrange(1, 4))
+            if rng.randrange(4) == 0:
+                cut = rng.randrange(len(message))
+                message = message[:cut] + bytes([rng.randrange(256)]) + message[cut + 1:]
+            return message
+
+        def binary_message():
+            key = rng.choice(allowed)
+            fields = [random_field() for _ in range(rng.randrange(8))]
+            target = rng.choice([None, rng.randrange(2 ** 32)])
+            frame = bytearray(_encode_binary_frame(list(key) + fields, target, rng.choice([None, rng.randrange(2 ** 32)])))
+            mutation = rng.randrange(4)
+            if mutation == 0 and len(frame) > 4:
+                # anywhere but the length, so no second frame can appear out of the remains
+                offset = rng.randrange(4, len(frame))
+                frame[offset] ^= 1 << rng.randrange(8)
+            elif mutation == 1:
+                frame = frame[:rng.randrange(1, len(frame) + 1)]
+            elif mutation == 2:
+                frame[:4] = struct.pack('<I', len(frame) - 4 + rng.randrange(1, 2 ** 16))
+            if len(frame) >= 6 and struct.unpack_from('<H', frame, 4)[0] & ~(_OPCODE_FLAG_ID | _OPCODE_FLAG_TARGET) in forbidden_opcodes:
+                return None
+            return bytes(frame)
+
+        results = {'seed': seed, 'sent': 0, 'skipped': 0, 'reconnects': 0}
+        fuzzed = None
+        start = time.perf_counter()
+        for _ in range(iterations):
+            transport_version = rng.choice([1, 2])
+            message = text_message() if transport_version == 1 else binary_message()
+            if not message or (transport_version == 1 and any(word in message for word in forbidden_words)):
+                results['skipped'] += 1
+                continue
+
+            try:
+                if fuzzed is None or fuzzed._transport_version != transport_version:
+                    if fuzzed is not None:
+                        fuzzed.pipe.close()
+                    fuzzed = ControlPipe(transport_version=transport_version, instance=self._instance)
+                fuzzed.pipe.write(message)
+                # each request is one message, answered by one
+                fuzzed.pipe.read(1024 * 1024)
+            except OSError:
+                # the DLL may drop a connection it can't make sense of
+                fuzzed = None
+                results['reconnects'] += 1
+            results['sent'] += 1
+
+            # still serving everyone else
+            self.get_width()
+
+        if fuzzed is not None:
+            fuzzed.pipe.close()
+        results['requests_per_sec'] = int(results['sent'] / (time.perf_counter() - start))
+        self.clear()
+
+        for name, result in results.items():
+            print(f'{name}: {result}')
+        return results
+
+class _AsyncPipeProtocol(asyncio.Protocol):
+    ''' Splits what arrives on an AsyncControlPipe into responses and hands each, with its request id, to on_response '''
+    def __init__(self, pipe:'AsyncControlPipe'):
+        self._pipe = pipe
+        self._received = bytearray()
+
+    def data_received(self, data:bytes) -> None:
+        self._received += data
+        while True:
+            if self._pipe._transport_version == 2:
+                if len(self._received) < 4:
+                    return
+                length, = struct.unpack_from('<I', self._received)
+                if len(self._received) < 4 + length:
+                    return
+                request_id, response = _decode_binary_frame_with_id(bytes(self._received[4:4 + length]))
+                del self._received[:4 + length]
+            else:
+                end = self._received.find(b'\n')
+                if end < 0:
+                    return
+                request_id, response = _decode_text_response(bytes(self._received[:end]))
+                del self._received[:end + 1]
+
+            self._pipe._on_response(request_id, response)
+
+    def connection_lost(self, exc) -> None:
+        self._pipe._on_closed(exc)
+
+class AsyncControlPipe:
+    '''
+    A ControlPipe for asyncio code, which never blocks the event loop. Each command gets a request id and doesn't wait
+    for the ones before it: many can be in flight, and their responses are matched back to them by id.
+    Commands sent within the same turn of the loop are written together, in a single BATCH (or frame) write.
+
+    Needs the proactor event loop (the default on Windows). Get one with:
+        pipe = await AsyncControlPipe.connect()
+        await pipe.send_command(['SET', 'TEXT', 'hi'], target=handle)
+    '''
+    def __init__(self, loop:asyncio.AbstractEventLoop):
+        ''' Use connect() instead '''
+        self._loop = loop
+        self._transport = None
+        self._transport_version = 1
+        self._request_ids = itertools.count(1)
+        # request id -> (future, check_ok)
+        self._pending = {}
+        self._queued = []
+        self._flush_scheduled = False
+
+    @classmethod
+    async def connect(cls, transport_version:int=1, instance:int=0) -> 'AsyncControlPipe':
+        '''
+        Connects to the given instance of PyDeskband (raising FileNotFoundError if it isn't in use), then switches to
+        transport_version
+        '''
+        loop = asyncio.get_running_loop()
+        self = cls(loop)
+        path = _instance_name(_PIPE_PATH, instance)
+        self._transport, _ = await loop.create_pipe_connection(lambda: _AsyncPipeProtocol(self), path)
+        if transport_version != 1:
+            await self.send_command(['SET', 'TRANSPORT_VERSION', transport_version])
+            self._transport_version = transport_version
+        return self
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, type, value, traceback):
+        await self.close()
+
+    async def close(self) -> None:
+        ''' Waits for every command in flight, then closes the pipe '''
+        if self._pending:
+            await asyncio.gather(*[future for future, _ in self._pending.values()], return_exceptions=True)
+        self._transport.close()
+
+    def send_command(self, cmd:Union[list, tuple, str], check_ok:bool=True, target:Union[int, None]=None) -> asyncio.Future:
+        '''
+        Queues the command (as for ControlPipe.send_command()) and returns a future for its return fields.
+        It's sent at the end of this turn of the event loop, with whatever else is queued by then.
+        '''
+        future = self._loop.create_future()
+        if self._transport is None or self._transport.is_closing():
+            future.set_exception(EOFError("The PyDeskbandControlPipe was closed"))
+            return future
+
+        request_id = next(self._request_ids) & 0xFFFFFFFF
+        self._queued.append(_encode_command(cmd, self._transport_version, target, request_id))
+        self._pending[request_id] = (future, check_ok)
+        if not self._flush_scheduled:
+            self._flush_scheduled = True
+            self._loop.call_soon(self._flush)
+        return future
+
+    def _flush(self) -> None:
+        ''' Writes everything queued. Each write is one request (a BATCH in version 1) as far as the DLL is concerned. '''
+        self._flush_scheduled = False
+        queued, self._queued = self._queued, []
+        for start in range(0, len(queued), _BATCH_MAX_COMMANDS):
+            cmds = queued[start:start + _BATCH_MAX_COMMANDS]
+            if self._transport_version == 2:
+                self._transport.write(b''.join(cmds))
+            elif len(cmds) == 1:
+                self._transport.write(cmds[0])
+            else:
+                self._transport.write(b'\n'.join([b'BATCH'] + cmds))
+
+    def _on_response(self, request_id:Union[int, None], response:list) -> None:
+        ''' Called by the protocol for each response that arrives '''
+        future, check_ok = self._pending.pop(request_id, (None, False))
+        if future is None or future.done():
+            # not ours (or abandoned)
+            return
+
+        if check_ok:
+            if response[0] != 'OK':
+                future.set_exception(ValueError(f"Response was not OK. It was: {response[0]}"))
+                return
+            response = response[1:]
+        future.set_result(response)
+
+    def _on_closed(self, exc) -> None:
+        ''' Called by the protocol once the pipe is gone: nothing in flight will get a response '''
+        pending, self._pending = self._pending, {}
+        for future, _ in pending.values():
+            if not future.done():
+                future.set_exception(EOFError(f"The PyDeskbandControlPipe was closed: {exc}"))
+
+class Renderer(enum.IntEnum):
+    ''' What the deskband draws with (see ControlPipe.set_renderer) '''
+    GDI = 0
+    DIRECT2D = 1
+
+class LogLevel(enum.IntEnum):
+    ''' Must match LogLevel in Logger.h '''
+    ERROR = 0
+    WARNING = 1
+    INFO = 2
+    VERBOSE = 3
+
 class Justification(enum.Enum):
     LEFT_OF = 'Left of'
     RIGHT_OF = 'Right of'
     BELOW = 'Below'
     ABOVE = 'Above'
 
+@dataclass
+class TextInfoState:
+    ''' What a TextInfo looked like when read by ControlPipe.get_all() '''
+    text_info: 'TextInfo'
+    text: str
+    x: int
+    y: int
+    color: Color
+
+class Align(enum.IntEnum):
+    ''' Which part of a TextInfo sits on its layout's anchor. Must match LayoutAlign in Layout.h '''
+    START = 0
+    CENTER = 1
+    END = 2
+
+class Flow(enum.IntEnum):
+    ''' Where a TextInfo following another one goes. Must match LayoutFlow in Layout.h '''
+    RIGHT = 0
+    BELOW = 1
+
+class Easing(enum.IntEnum):
+    ''' How an animation speeds up and slows down. Must match Easing in Animation.h '''
+    LINEAR = 0
+    EASE_IN = 1
+    EASE_OUT = 2
+    EASE_IN_OUT = 3
+
+class _AnimatedProperty(enum.IntEnum):
+    ''' Must match AnimatedProperty in Animation.h '''
+    RGB = 0
+    XY = 1
+    VALUE = 2
+
 class TextInfo:
     '''
     Represents a reference to a TextInfo object in the DLL.
 
     A TextInfo is a specific line/piece of text with a specific X/Y, RGB color, and text.
     '''
-    def __init__(self, control_pipe:ControlPipe, idx:int):
+    def __init__(self, control_pipe:ControlPipe, handle:int):
         self.controlPipe = control_pipe
-        self._idx = idx
-
-    @contextlib.contextmanager
-    def targeting_this_textinfo(self):
-        previous_target = self.controlPipe._get_textinfo_target()
-        self.controlPipe._set_textinfo_target(self._idx)
-        try:
-            yield
-        finally:
-            self.controlPipe._set_textinfo_target(previous_target)
+        # Stays valid until this TextInfo is deleted (or cleared), regardless of what happens to the others
+        self._handle = handle
 
     def set_text(self, text:str) -> None:
         ''' Sets the text of this TextInfo '''
-        with self.targeting_this_textinfo():
-            self.controlPipe._set_text(text)
+        self.controlPipe._set_text(text, target=self._handle)
 
     def set_color(self, red:int=255, green:int=255, blue:int=255) -> None:
         ''' Sets the color of this TextInfo '''
-        with self.targeting_this_textinfo():
-            self.controlPipe._set_color(red, green, blue)
+        self.controlPipe._set_color(red, green, blue, target=self._handle)
 
     def set_coordinates(self, x:int=0, y:int=0) -> None:
         ''' Sets the X/Y coordinates of this TextInfo '''
-        with self.targeting_this_textinfo():
-            self.controlPipe._set_coordinates(x, y)
+        self.controlPipe._set_coordinates(x, y, target=self._handle)
+
+    def set_layout(self, x_percent:int=0, y_percent:int=0, x_offset:int=0, y_offset:int=0,
+                   horizontal:Align=Align.START, vertical:Align=Align.START,
+                   after:Union['TextInfo', None]=None, flow:Flow=Flow.RIGHT, gap:int=0) -> None:
+        '''
+        Lets the DLL place this TextInfo from now on, even as its text or the band's size changes (no need for
+        get_text_size() and set_coordinates() on every update).
+
+        The anchor is x_percent/y_percent (0-100) of the band's size plus the offsets in pixels, and horizontal/vertical
+        say which part of the text sits on it: set_layout(50, 50, horizontal=Align.CENTER, vertical=Align.CENTER) centers it.
+        If after is given, this goes gap pixels to the right of (or below, per flow) that TextInfo instead, along that axis.
+
+        set_coordinates() places it explicitly again.
+        '''
+        for percent in (x_percent, y_percent):
+            if not 0 <= percent <= 100:
+                raise ValueError(f"Percentages must be from 0 to 100. One was: {percent}")
+
+        self.controlPipe._set_layout(x_percent, y_percent, x_offset, y_offset, horizontal, vertical,
+                                     after._handle if after is not None else None, flow, gap, target=self._handle)
+
+    def clear_layout(self) -> None:
+        ''' Stops laying out this TextInfo. It stays where it was last placed. '''
+        self.controlPipe._clear_layout(target=self._handle)
+
+    def animate_color(self, color:Color, duration_ms:int, easing:Easing=Easing.LINEAR) -> None:
+        '''
+        Fades this TextInfo from its current color to color over duration_ms. The DLL steps the fade and repaints it on
+        its own, once per frame, so nothing more needs to be sent. set_color() stops it where it is.
+        '''
+        self.controlPipe._set_animation(_AnimatedProperty.RGB, duration_ms, easing, [color.red, color.green, color.blue], target=self._handle)
+
+    def animate_coordinates(self, x:int, y:int, duration_ms:int, easing:Easing=Easing.LINEAR) -> None:
+        ''' Moves this TextInfo to x, y over duration_ms, like animate_color(). Like set_coordinates(), it ends any layout. '''
+        self.controlPipe._set_animation(_AnimatedProperty.XY, duration_ms, easing, [x, y], target=self._handle)
+
+    def animate_value(self, value:float, duration_ms:int, easing:Easing=Easing.LINEAR, decimals:int=0) -> None:
+        '''
+        Counts this TextInfo's text from the number it shows now (or straight to value, if it isn't one) to value over
+        duration_ms, with decimals digits after the decimal point. set_text() stops it where it is.
+        '''
+        if not 0 <= decimals <= 9:
+            raise ValueError(f"decimals must be from 0 to 9. It was: {decimals}")
+        self.controlPipe._set_animation(_AnimatedProperty.VALUE, duration_ms, easing, [round(value * 10 ** decimals), decimals], target=self._handle)
+
+    def stop_animations(self) -> None:
+        ''' Stops this TextInfo's animations wherever they have gotten to '''
+        self.controlPipe._clear_animations(target=self._handle)
 
     def get_text(self) -> str:
         ''' Gets the text of this TextInfo '''
-        with self.targeting_this_textinfo():
-            return self.controlPipe._get_text()
+        return self.controlPipe._get_text(target=self._handle)
 
     def get_color(self) -> Color:
         ''' Gets the color of this TextInfo '''
-        with self.targeting_this_textinfo():
-            return self.controlPipe._get_color()
+        return self.controlPipe._get_color(target=self._handle)
 
     def get_coordinates(self) -> Size:
         ''' Gets the X/Y coordinates of this TextInfo '''
-        with self.targeting_this_textinfo():
-            return self.controlPipe._get_coordinates()
+        return self.controlPipe._get_coordinates(target=self._handle)
+
+    def delete(self) -> None:
+        ''' Deletes this TextInfo (and takes it off the screen). Other TextInfos are not affected. '''
+        self.controlPipe._delete_text_info(self._handle)
 
     def get_text_size(self) -> Size:
         ''' Gets the pixel size of the text within this TextInfo '''
@@ -405,4 +1381,141 @@ class TextInfo:
 
             self.set_coordinates(that_coordinates.x, max(0, new_y))
         else:
-            raise ValueError("justify must be defined in the Justification enum")
\ No newline at end of file
+            raise ValueError("justify must be defined in the Justification enum")
+
+class GraphStyle(enum.IntEnum):
+    ''' Must match GraphStyle in Graph.h '''
+    LINE = 0
+    BARS = 1
+
+class Graph:
+    '''
+    Represents a reference to a Graph object in the DLL.
+
+    A Graph keeps a fixed number of the latest samples of a value and draws them as a sparkline or bar graph.
+    '''
+    def __init__(self, control_pipe:ControlPipe, handle:int):
+        self.controlPipe = control_pipe
+        self._handle = handle
+
+    def set(self, x:int, y:int, width:int, height:int, minimum:int=0, maximum:int=100,
+            red:int=255, green:int=255, blue:int=255, style:GraphStyle=GraphStyle.LINE) -> None:
+        ''' Sets where, and how, this Graph is drawn. Samples are scaled from minimum..maximum to the height. '''
+        self.controlPipe.send_command([
+            'SET', 'GRAPH', self._handle, x, y, width, height, red, green, blue, minimum, maximum, int(style)
+        ])
+
+    def append(self, *samples:int) -> None:
+        ''' Appends the given (integer) samples, dropping the oldest ones once full '''
+        if samples:
+            self.controlPipe.send_command(['GRAPH_APPEND', self._handle, ' '.join(str(int(s)) for s in samples)])
+
+    def delete(self) -> None:
+        ''' Deletes this Graph (and takes it off the screen) '''
+        self.controlPipe.send_command(['DELETE_GRAPH', self._handle])
+
+class Event(enum.IntFlag):
+    ''' Must match the EVENT_* bits in EventQueue.h '''
+    SIZE = 0x01
+    DPI = 0x02
+    COMPOSITION = 0x04
+    VISIBILITY = 0x08
+    WIN_MSG = 0x10
+
+class EventSubscription:
+    '''
+    A connection of its own that the DLL pushes events down. Get one via ControlPipe.subscribe().
+
+    The current state of whatever was subscribed to (size, DPI, composition, visibility) arrives first.
+    Closing it unsubscribes.
+    '''
+    def __init__(self, events:Event, messages:tuple=(), transport_version:int=1, instance:int=0):
+        self._pipe = ControlPipe(transport_version, instance)
+        self._pipe.send_command(['SUBSCRIBE', int(events)] + [int(m) for m in messages])
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, type, value, traceback):
+        self.close()
+
+    def __iter__(self):
+        ''' Yields events, as read() gives them, until the connection closes '''
+        try:
+            while True:
+                yield self.read()
+        except EOFError:
+            return
+
+    def close(self) -> None:
+        self._pipe.pipe.close()
+
+    def read(self) -> tuple:
+        ''' Blocks until the next event. Returns (name, values), like ('SIZE', [300, 40]) or ('WIN_MSG', [1024]) '''
+        response = self._pipe._read_response(check_ok=False)
+        if response == ['']:
+            raise EOFError("The PyDeskbandControlPipe was closed")
+        if response[0] != 'EVENT' or len(response) < 2:
+            raise ValueError(f"Expected an event. Got: {response}")
+
+        # text responses end with a delimiter, so the last field may be empty
+        return response[1], [int(v) for v in response[2:] if v != '']
+
+class SharedState:
+    '''
+    Writes TextInfos straight into the DLL's shared memory (see SharedState.h), without a round trip per update.
+    Get one via ControlPipe.enable_shared_state(). Only one writer should use a given slot at a time.
+    '''
+    # These must match SharedState.h
+    NAME = 'PyDeskbandSharedState'
+    MAGIC = 0x53445950
+    VERSION = 1
+    SLOTS = 32
+    TEXT_SIZE = 256
+    _VISIBLE = 0x1
+    _HEADER = struct.Struct('<IIII')
+    _SEQUENCE = struct.Struct('<I')
+    _FIELDS = struct.Struct(f'<IiiBBBBI{TEXT_SIZE}s')
+
+    def __init__(self, instance:int=0):
+        ''' instance is the band's, as for ControlPipe: each has its own slots '''
+        size = self._HEADER.size + self.SLOTS * (self._SEQUENCE.size + self._FIELDS.size)
+        self._mmap = mmap.mmap(-1, size, tagname=_instance_name(self.NAME, instance))
+        magic, version, slot_count, slot_size = self._HEADER.unpack_from(self._mmap, 0)
+        if magic != self.MAGIC or version != self.VERSION or slot_count != self.SLOTS or slot_size != self._SEQUENCE.size + self._FIELDS.size:
+            self._mmap.close()
+            raise RuntimeError("The DLL's shared state doesn't match this version of pydeskband")
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, type, value, traceback):
+        self.close()
+
+    def close(self) -> None:
+        self._mmap.close()
+
+    def set_slot(self, idx:int, text:str, x:int=0, y:int=0, red:int=255, green:int=255, blue:int=255) -> None:
+        ''' Shows text at x, y in the given slot '''
+        encoded = text.encode()
+        if len(encoded) > self.TEXT_SIZE:
+            raise ValueError(f"text must be at most {self.TEXT_SIZE} bytes of UTF-8")
+
+        self._write_slot(idx, self._VISIBLE, x, y, red, green, blue, encoded)
+
+    def hide_slot(self, idx:int) -> None:
+        ''' Removes the given slot's text from the deskband '''
+        self._write_slot(idx, 0, 0, 0, 0, 0, 0, b'')
+
+    def _write_slot(self, idx:int, flags:int, x:int, y:int, red:int, green:int, blue:int, text:bytes) -> None:
+        if not 0 <= idx < self.SLOTS:
+            raise IndexError(f"slot must be in [0, {self.SLOTS})")
+
+        offset = self._HEADER.size + idx * (self._SEQUENCE.size + self._FIELDS.size)
+        sequence, = self._SEQUENCE.unpack_from(self._mmap, offset)
+
+        # odd while we write, so the band never uses a half written slot. (If a writer died mid-write, it's already odd.)
+        writing = ((sequence + 1) | 1) & 0xFFFFFFFF
+        self._SEQUENCE.pack_into(self._mmap, offset, writing)
+        self._FIELDS.pack_into(self._mmap, offset + self._SEQUENCE.size, flags, x, y, red, green, blue, 0, len(text), text)
+        self._SEQUENCE.pack_into(self._mmap, offset, (writing + 1) & 0xFFFFFFFF)